@@ -1,6 +1,8 @@
 #ifndef SK_COMMON_H
 #define SK_COMMON_H
 
+#include <array>
+#include <cstddef>
 #include <cstdint>
 #include <unistd.h>
 
@@ -9,6 +11,7 @@ enum common {
     PLAYER_MAX_CHAR = 126,
     PLAYER_NAME_LENGTH = 20,
     MAX_PLAYERS = 25,
+    MAX_WORMS = 255,
     
     STRAIGHT = 0,
     RIGHT,
@@ -16,21 +19,22 @@ enum common {
     
     RCV_WAIT = 100,
     MAX_UDP = 550,
+    MAX_DATAGRAM = 65507,
+    DATAGRAM_UNIT = 256,
     
     BYTE_RANGE = 256,
     DWORD = 4,
     BYTE = 1,
     
-    PIXEL_LENGTH = 14,
-    ELIMINATED_LENGTH = 6,
     EVENT_BASIC_LENGTH = 13,
     LENGTH_BYTES = 4,
-    GAME_OVER_LENGTH = 5,
     
     NEW_GAME_TYPE = 0,
     PIXEL_TYPE,
     ELIMINATED_TYPE,
     GAME_OVER_TYPE,
+
+    CLIENT_COMPRESSION = 1,
 };
 
 const uint32_t crc32_tab[] = {
@@ -85,7 +89,118 @@ struct client_mess_t {
     uint32_t next_expected_event_no;
     int8_t player_name[PLAYER_NAME_LENGTH];
 
+    // Optional. Nonzero value asks for datagrams of up to padding * DATAGRAM_UNIT bytes.
     uint8_t padding;
+
+    // Optional, comes only after padding. CLIENT_COMPRESSION asks for compressed
+    // catch-up (see screen-worms-compress.h).
+    uint8_t flags;
 } __attribute__((packed));
 
+// Size of message with padding byte but without flags.
+const size_t CLIENT_MESS_PADDED = offsetof(client_mess_t, flags);
+
+// Calculates crc32 of given data.
+inline uint32_t calculate_crc32(const uint8_t *data, uint64_t len) {
+    uint32_t crc = 0xFFFFFFFF;
+
+    for (uint64_t i = 0; i < len; i++) {
+        uint64_t temp = (crc ^ data[i]) & 0xFF;
+        crc = (crc >> 8) ^ crc32_tab[temp];
+    }
+
+    return crc ^ 0xFFFFFFFF;
+}
+
+// Converts given amount of bytes from buffer (with offset) from Big Endian to Host.
+// Updates offset of the amount of converted bytes.
+inline uint64_t convert_bytes_to_number(const uint8_t *buff, uint64_t &offset, int bytes) {
+    uint64_t result = 0;
+
+    for (int i = 0; i < bytes; i++) {
+        result *= BYTE_RANGE;
+        result += (buff + offset)[i];
+    }
+
+    offset += bytes;
+    return result;
+}
+
+// Writes given amount of bytes of number to buffer in Big Endian order.
+// Returns pointer right after the written bytes.
+inline uint8_t *convert_number_to_bytes(uint8_t *buff, uint64_t number, int bytes) {
+    for (int i = bytes - 1; i >= 0; i--) {
+        buff[i] = number % BYTE_RANGE;
+        number /= BYTE_RANGE;
+    }
+
+    return buff + bytes;
+}
+
+// Wire layout of consecutive Big Endian fields of given widths (in bytes).
+// Both server's encoders and client's decoders are generated from it.
+template<int... WIDTHS>
+struct layout_t {
+    static constexpr int fields = sizeof...(WIDTHS);
+    static constexpr int size = (WIDTHS + ... + 0);
+
+    template<typename... VALUES>
+    static uint8_t *encode(uint8_t *buff, VALUES... values) {
+        static_assert(sizeof...(VALUES) == fields, "wrong amount of fields");
+
+        ((buff = convert_number_to_bytes(buff, values, WIDTHS)), ...);
+        return buff;
+    }
+
+    static std::array<uint64_t, fields> decode(const uint8_t *buff, uint64_t &offset) {
+        std::array<uint64_t, fields> result {};
+        int i = 0;
+
+        ((result[i++] = convert_bytes_to_number(buff, offset, WIDTHS)), ...);
+        return result;
+    }
+};
+
+using game_id_layout = layout_t<DWORD>;
+using event_len_layout = layout_t<DWORD>;
+using event_head_layout = layout_t<DWORD, BYTE>;        // event_no, event_type
+using crc_layout = layout_t<DWORD>;
+
+using new_game_layout = layout_t<DWORD, DWORD>;         // maxx, maxy (player names follow)
+using pixel_layout = layout_t<BYTE, DWORD, DWORD>;      // player_number, x, y
+using eliminated_layout = layout_t<BYTE>;               // player_number
+using game_over_layout = layout_t<>;
+
+// Whole event: len, event_no, event_type, event_data and crc32.
+// len is the value of the len field and size is the size of encoded event
+// (both without variable part of event_data).
+template<int TYPE, typename DATA>
+struct event_layout_t {
+    static constexpr int type = TYPE;
+    static constexpr int len = event_head_layout::size + DATA::size;
+    static constexpr int size = event_len_layout::size + len + crc_layout::size;
+
+    // Encodes everything preceding event_data. Returns pointer to event_data.
+    static uint8_t *encode_head(uint8_t *buff, uint32_t event_len, uint32_t event_no) {
+        buff = event_len_layout::encode(buff, event_len);
+        return event_head_layout::encode(buff, event_no, TYPE);
+    }
+
+    // Encodes event without crc. Returns pointer to place for crc.
+    template<typename... VALUES>
+    static uint8_t *encode(uint8_t *buff, uint32_t event_no, VALUES... values) {
+        return DATA::encode(encode_head(buff, len, event_no), values...);
+    }
+};
+
+using new_game_event = event_layout_t<NEW_GAME_TYPE, new_game_layout>;
+using pixel_event = event_layout_t<PIXEL_TYPE, pixel_layout>;
+using eliminated_event = event_layout_t<ELIMINATED_TYPE, eliminated_layout>;
+using game_over_event = event_layout_t<GAME_OVER_TYPE, game_over_layout>;
+
+static_assert(new_game_event::len == EVENT_BASIC_LENGTH, "NEW_GAME layout");
+static_assert(pixel_event::len == 14, "PIXEL layout");
+static_assert(eliminated_event::len == 6, "PLAYER_ELIMINATED layout");
+static_assert(game_over_event::len == 5, "GAME_OVER layout");
+
 #endif
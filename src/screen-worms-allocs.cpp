@@ -0,0 +1,84 @@
+#include "screen-worms-allocs.h"
+
+#ifdef SK_COUNT_ALLOCATIONS
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <unistd.h>
+
+using namespace std;
+
+static thread_local int hot_path = HOT_PATH_OFF;
+static atomic<uint64_t> hot_path_allocations {0};
+
+int hot_path_state() {
+    return hot_path;
+}
+
+void set_hot_path_state(int state) {
+    hot_path = state;
+}
+
+uint64_t take_hot_path_allocations() {
+    return hot_path_allocations.exchange(0);
+}
+
+// Counts the allocation if it's made in the hot path. Nothing that
+// allocates may be called here, so the message is written directly.
+static void note_allocation() {
+    if (hot_path == HOT_PATH_OFF) {
+        return;
+    }
+
+    hot_path_allocations.fetch_add(1, memory_order_relaxed);
+
+    if (hot_path == HOT_PATH_STRICT) {
+        static const char message[] = "heap allocation in the hot path of a tick\n";
+        ssize_t written = write(STDERR_FILENO, message, sizeof(message) - 1);
+        (void) written;
+        abort();
+    }
+}
+
+void *operator new(size_t size) {
+    note_allocation();
+    void *ptr = malloc(size ? size : 1);
+
+    if (ptr == nullptr) {
+        throw bad_alloc();
+    }
+
+    return ptr;
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void *operator new(size_t size, const nothrow_t&) noexcept {
+    note_allocation();
+    return malloc(size ? size : 1);
+}
+
+void *operator new[](size_t size, const nothrow_t&) noexcept {
+    return operator new(size, nothrow);
+}
+
+void operator delete(void *ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept {
+    free(ptr);
+}
+
+#endif
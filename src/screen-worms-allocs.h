@@ -0,0 +1,40 @@
+#ifndef SK_SCREEN_WORMS_ALLOCS_H
+#define SK_SCREEN_WORMS_ALLOCS_H
+
+#include <cstdint>
+
+enum constants_allocs {
+    HOT_PATH_OFF = 0,
+    HOT_PATH_COUNTED,
+    HOT_PATH_STRICT,
+};
+
+// Hot path of a tick is expected not to allocate once the server has warmed
+// up. Built with -DSK_COUNT_ALLOCATIONS, the server replaces global operator new
+// with one that counts heap allocations made by a thread inside the hot path
+// and aborts on them in strict hot path. Otherwise marking the hot path costs nothing.
+#ifdef SK_COUNT_ALLOCATIONS
+
+// Returns hot path state of the calling thread.
+int hot_path_state();
+
+void set_hot_path_state(int state);
+
+// Returns amount of allocations in hot paths since the last call.
+uint64_t take_hot_path_allocations();
+
+#else
+
+inline int hot_path_state() {
+    return HOT_PATH_OFF;
+}
+
+inline void set_hot_path_state(int) {}
+
+inline uint64_t take_hot_path_allocations() {
+    return 0;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,216 @@
+#include "screen-worms-server.h"
+#include <sys/time.h>
+
+// Benchmark of worm movement in a mass arena: thousands of worms on a big board.
+// Compares ticks per second of the original one-worm-at-a-time loop with the
+// structure of arrays movement at every supported instruction set and checks
+// that all of them produce the same events.
+
+enum constants_arena {
+    ARENA_RAND_MULT = 48271,
+    ARENA_RAND_MOD = 2147483647,
+    ARENA_SIZE = 2000,
+};
+
+struct options_arena_t {
+    int worms = 4000;
+    int width = ARENA_SIZE;
+    int height = ARENA_SIZE;
+    int ticks = 1000;
+    uint32_t seed = 1;
+};
+
+// Worm as it was stored before structure of arrays.
+struct aos_worm_t {
+    double pos_x = 0;
+    double pos_y = 0;
+    int direction = 0;
+    uint8_t turn_direction = 0;
+
+    bool eliminated = false;
+};
+
+// Returns current time in microseconds.
+uint64_t get_time() {
+    timeval tv {};
+    gettimeofday(&tv, nullptr);
+    return tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+void update_options(options_arena_t &opts, int argc, char *argv[]) {
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:w:h:t:s:")) != -1) {
+        if (opt == '?') {
+            cout<<"unknown option"<<endl;
+            exit(1);
+        }
+
+        char *ptr;
+        uint32_t val = strtol(optarg, &ptr, 10);
+
+        if (*ptr != 0) {
+            cout<<"incorrect option value"<<endl;
+            exit(1);
+        }
+
+        if (opt == 'n') {
+            opts.worms = val;
+        }
+        else if (opt == 'w') {
+            opts.width = min<uint32_t>(val, MAX_WIDTH);
+        }
+        else if (opt == 'h') {
+            opts.height = min<uint32_t>(val, MAX_HEIGHT);
+        }
+        else if (opt == 't') {
+            opts.ticks = val;
+        }
+        else if (opt == 's') {
+            opts.seed = val;
+        }
+    }
+}
+
+// Places worms on empty board. Every run with the same options starts the same.
+void setup_arena(memory_server_t &mem, options_arena_t &opts) {
+    uint64_t r = opts.seed;
+    auto next = [&r]() {
+        r = r * ARENA_RAND_MULT % ARENA_RAND_MOD;
+        return static_cast<uint32_t>(r);
+    };
+
+    mem.WIDTH = opts.width;
+    mem.HEIGHT = opts.height;
+    mem.worms.clear();
+    mem.events.clear();
+    clean_board(mem);
+    mem.worms_alive = opts.worms;
+
+    for (int i = 0; i < opts.worms; i++) {
+        double pos_x = next() % mem.WIDTH + 0.5;
+        double pos_y = next() % mem.HEIGHT + 0.5;
+        int direction = next() % 360;
+        int x = floor(pos_x);
+        int y = floor(pos_y);
+        bool eliminated = mem.board.get(x, y);
+
+        if (eliminated) {
+            mem.worms_alive--;
+            add_eliminated_event(mem, i);
+        }
+        else {
+            mem.board.set(x, y);
+            add_pixel_event(mem, i, x, y);
+        }
+
+        mem.worms.push_back(pos_x, pos_y, direction, i % 3, eliminated, false);
+    }
+}
+
+// The original movement loop, kept as reference.
+bool reference_moves(memory_server_t &mem, vector<aos_worm_t> &worms) {
+    for (size_t i = 0; i < worms.size(); i++) {
+        aos_worm_t *worm = &worms[i];
+
+        if (!worm->eliminated) {
+            int old_x = floor(worm->pos_x);
+            int old_y = floor(worm->pos_y);
+
+            if (worm->turn_direction == RIGHT) {
+                worm->direction += mem.TURNING_SPEED;
+            }
+            else if (worm->turn_direction == LEFT) {
+                worm->direction += 360 - mem.TURNING_SPEED;
+            }
+            worm->direction %= 360;
+
+            worm->pos_x += cos(worm->direction * M_PI / 180);
+            worm->pos_y += sin(worm->direction * M_PI / 180);
+            int new_x = floor(worm->pos_x);
+            int new_y = floor(worm->pos_y);
+
+            if (old_x != new_x || old_y != new_y) {
+                if (new_x < 0 || mem.WIDTH <= new_x || new_y < 0 || mem.HEIGHT <= new_y ||
+                    mem.board.get(new_x, new_y)) {
+                    mem.worms_alive--;
+                    worm->eliminated = true;
+                    add_eliminated_event(mem, i);
+
+                    if (mem.worms_alive == 1) {
+                        return true;
+                    }
+                }
+                else {
+                    mem.board.set(new_x, new_y);
+                    add_pixel_event(mem, i, new_x, new_y);
+                }
+            }
+        }
+    }
+
+    return false;
+}
+
+// Runs one mode (level -1 is the reference loop) and prints its results.
+// Returns the events produced.
+vector<uint8_t> run_mode(memory_server_t &mem, options_arena_t &opts, int level, const char *name,
+                         const vector<uint8_t> *expected) {
+    setup_arena(mem, opts);
+    mem.SIMD_LEVEL = level;
+
+    vector<aos_worm_t> aos_worms;
+    for (size_t i = 0; i < mem.worms.size(); i++) {
+        aos_worm_t worm {};
+        worm.pos_x = mem.worms.pos_x[i];
+        worm.pos_y = mem.worms.pos_y[i];
+        worm.direction = mem.worms.direction[i];
+        worm.turn_direction = mem.worms.turn_direction[i];
+        worm.eliminated = mem.worms.eliminated[i];
+        aos_worms.push_back(worm);
+    }
+
+    int ticks = 0;
+    uint64_t start = get_time();
+
+    while (ticks < opts.ticks && mem.worms_alive > 1) {
+        ticks++;
+
+        if (level < 0 ? reference_moves(mem, aos_worms) : make_moves(mem)) {
+            break;
+        }
+    }
+
+    double seconds = max<uint64_t>(get_time() - start, 1) / 1e6;
+
+    // Game over event added by make_moves is not part of the comparison.
+    vector<uint8_t> events = mem.events.data;
+    if (level >= 0 && mem.worms_alive == 1) {
+        events.resize(mem.events.offsets.back());
+    }
+
+    bool identical = (expected == nullptr || *expected == events);
+
+    cout<<"mode="<<name<<" worms="<<opts.worms<<" board="<<mem.WIDTH<<"x"<<mem.HEIGHT
+        <<" ticks="<<ticks<<" alive="<<mem.worms_alive<<" ticks_per_sec="<<ticks / seconds
+        <<" identical="<<(identical ? "yes" : "no")<<endl;
+
+    return events;
+}
+
+int main(int argc, char *argv[]) {
+    options_arena_t opts {};
+    update_options(opts, argc, argv);
+
+    auto mem = make_unique<memory_server_t>();
+    vector<uint8_t> expected = run_mode(*mem, opts, -1, "reference", nullptr);
+    int best = detect_simd_level();
+
+    run_mode(*mem, opts, SIMD_SCALAR, "scalar", &expected);
+    if (best >= SIMD_SSE41) {
+        run_mode(*mem, opts, SIMD_SSE41, "sse4.1", &expected);
+    }
+    if (best >= SIMD_AVX2) {
+        run_mode(*mem, opts, SIMD_AVX2, "avx2", &expected);
+    }
+}
@@ -0,0 +1,228 @@
+#include "screen-worms-server.h"
+#include <sys/time.h>
+
+// Batch runner: plays many complete games of bots offline, each seeded on its
+// own, on a work-stealing pool of threads. Runs the whole batch with 1, 2, ...
+// up to the given amount of threads and prints games and ticks per second of
+// each run, so the scaling curve can be read off. Every game lives in the
+// memory of the thread playing it (board, worms, event log and state of the
+// random number generator), so games don't share anything and a checksum of
+// their events tells whether all runs played the same games.
+
+enum constants_batch {
+    BATCH_SIZE = 200,
+};
+
+struct options_batch_t {
+    uint32_t games = 1000;
+    uint32_t threads = max(thread::hardware_concurrency(), 1u);
+    int width = BATCH_SIZE;
+    int height = BATCH_SIZE;
+    int bots = 4;
+    uint32_t max_ticks = 100000;
+    uint32_t seed = 1;
+};
+
+// Outcome of one game.
+struct game_result_t {
+    uint32_t ticks = 0;
+    uint32_t events = 0;
+    uint32_t crc = 0;
+};
+
+// Deque of games of one worker. The owner takes games from the back, other
+// workers steal from the front, so they rarely meet at the same end.
+struct work_queue_t {
+    mutex lock;
+    deque<uint32_t> games;
+};
+
+// Work-stealing pool. Games are dealt to workers in turn at the start; a worker
+// whose deque is empty steals from the others, so long games don't leave
+// threads idle. No work is added during the run, so the batch is over once
+// every deque is empty.
+struct pool_t {
+    vector<unique_ptr<work_queue_t>> queues;
+    atomic<uint64_t> steals {0};
+
+    explicit pool_t(uint32_t workers, uint32_t games) {
+        for (uint32_t i = 0; i < workers; i++) {
+            queues.push_back(make_unique<work_queue_t>());
+        }
+
+        for (uint32_t game = 0; game < games; game++) {
+            queues[game % workers]->games.push_back(game);
+        }
+    }
+
+    // Takes next game for given worker. Returns false if there are none left.
+    bool take(uint32_t worker, uint32_t &game) {
+        {
+            work_queue_t &own = *queues[worker];
+            lock_guard<mutex> guard(own.lock);
+
+            if (!own.games.empty()) {
+                game = own.games.back();
+                own.games.pop_back();
+                return true;
+            }
+        }
+
+        for (size_t i = 1; i < queues.size(); i++) {
+            work_queue_t &victim = *queues[(worker + i) % queues.size()];
+            lock_guard<mutex> guard(victim.lock);
+
+            if (!victim.games.empty()) {
+                game = victim.games.front();
+                victim.games.pop_front();
+                steals++;
+                return true;
+            }
+        }
+
+        return false;
+    }
+};
+
+// Returns current time in microseconds.
+uint64_t get_time() {
+    timeval tv {};
+    gettimeofday(&tv, nullptr);
+    return tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+void update_options(options_batch_t &opts, int argc, char *argv[]) {
+    int opt;
+
+    while ((opt = getopt(argc, argv, "g:j:w:h:a:t:s:")) != -1) {
+        if (opt == '?') {
+            cout<<"unknown option"<<endl;
+            exit(1);
+        }
+
+        char *ptr;
+        uint32_t val = strtol(optarg, &ptr, 10);
+
+        if (*ptr != 0) {
+            cout<<"incorrect option value"<<endl;
+            exit(1);
+        }
+
+        if (opt == 'g') {
+            opts.games = val;
+        }
+        else if (opt == 'j') {
+            opts.threads = max<uint32_t>(val, 1);
+        }
+        else if (opt == 'w') {
+            opts.width = min<uint32_t>(max<uint32_t>(val, 1), MAX_WIDTH);
+        }
+        else if (opt == 'h') {
+            opts.height = min<uint32_t>(max<uint32_t>(val, 1), MAX_HEIGHT);
+        }
+        else if (opt == 'a') {
+            opts.bots = min<uint32_t>(max<uint32_t>(val, 2), MAX_WORMS);
+        }
+        else if (opt == 't') {
+            opts.max_ticks = val;
+        }
+        else if (opt == 's') {
+            opts.seed = val;
+        }
+    }
+}
+
+// Plays one whole game in given memory. Game k of the batch is seeded with
+// seed + k, whichever thread plays it.
+game_result_t play_game(memory_server_t &mem, options_batch_t &opts, uint32_t game) {
+    game_result_t result;
+
+    mem.WIDTH = opts.width;
+    mem.HEIGHT = opts.height;
+    mem.BOTS = opts.bots;
+    mem.rand_state = opts.seed + game;
+    mem.next_game.prepared = false;
+
+    bool game_over = initialize_game(mem);
+
+    while (!game_over && result.ticks < opts.max_ticks) {
+        result.ticks++;
+        game_over = make_moves(mem);
+    }
+
+    result.events = mem.events.size();
+    result.crc = calculate_crc32(mem.events.data.data(), mem.events.data.size());
+
+    return result;
+}
+
+// Plays the whole batch on given amount of threads and prints how fast it went.
+// Returns the checksum of all games.
+uint32_t run_batch(options_batch_t &opts, uint32_t threads, double &single_rate) {
+    vector<game_result_t> results(opts.games);
+    pool_t pool(threads, opts.games);
+    vector<thread> workers;
+
+    uint64_t start = get_time();
+
+    for (uint32_t w = 0; w < threads; w++) {
+        workers.emplace_back([&, w]() {
+            auto mem = make_unique<memory_server_t>();
+            uint32_t game;
+
+            while (pool.take(w, game)) {
+                results[game] = play_game(*mem, opts, game);
+            }
+        });
+    }
+
+    for (thread &worker : workers) {
+        worker.join();
+    }
+
+    double seconds = max<uint64_t>(get_time() - start, 1) / 1e6;
+    uint64_t ticks = 0;
+    uint64_t events = 0;
+    vector<uint32_t> crcs;
+
+    for (game_result_t &result : results) {
+        ticks += result.ticks;
+        events += result.events;
+        crcs.push_back(result.crc);
+    }
+
+    uint32_t checksum = calculate_crc32(reinterpret_cast<uint8_t*>(crcs.data()), crcs.size() * sizeof(uint32_t));
+    double rate = opts.games / seconds;
+
+    if (threads == 1) {
+        single_rate = rate;
+    }
+
+    cout<<"threads="<<threads<<" games="<<opts.games<<" board="<<opts.width<<"x"<<opts.height
+        <<" bots="<<opts.bots<<" ticks="<<ticks<<" events="<<events<<" duration_us="<<static_cast<uint64_t>(seconds * 1e6)
+        <<" games_per_s="<<fixed<<setprecision(1)<<rate<<" ticks_per_s="<<ticks / seconds
+        <<" speedup="<<setprecision(2)<<rate / single_rate<<" steals="<<pool.steals
+        <<" checksum="<<hex<<checksum<<dec<<defaultfloat<<endl;
+
+    return checksum;
+}
+
+int main(int argc, char *argv[]) {
+    options_batch_t opts {};
+    update_options(opts, argc, argv);
+
+    double single_rate = 0;
+    uint32_t expected = 0;
+
+    for (uint32_t threads = 1; threads <= opts.threads; threads++) {
+        uint32_t checksum = run_batch(opts, threads, single_rate);
+
+        if (threads == 1) {
+            expected = checksum;
+        }
+        else if (checksum != expected) {
+            cout<<"games differ between runs"<<endl;
+            exit(1);
+        }
+    }
+}
@@ -0,0 +1,177 @@
+#ifndef SK_SCREEN_WORMS_BOARD_H
+#define SK_SCREEN_WORMS_BOARD_H
+
+#include <bits/stdc++.h>
+#include <sys/mman.h>
+
+using namespace std;
+
+enum constants_board {
+    TILE_BITS = 6,
+    TILE_SIZE = 1 << TILE_BITS,
+    TILE_MASK = TILE_SIZE - 1,
+
+    HUGE_PAGE_SIZE = 1 << 21,
+    TILES_PER_CHUNK = HUGE_PAGE_SIZE / (TILE_SIZE * 8),
+};
+
+// Asks for transparent huge pages in the part of given memory that covers
+// whole huge pages.
+inline void advise_huge_pages(void *ptr, size_t len) {
+    uintptr_t begin = (reinterpret_cast<uintptr_t>(ptr) + HUGE_PAGE_SIZE - 1) & ~(uintptr_t(HUGE_PAGE_SIZE) - 1);
+    uintptr_t end = (reinterpret_cast<uintptr_t>(ptr) + len) & ~(uintptr_t(HUGE_PAGE_SIZE) - 1);
+
+    if (begin < end) {
+        madvise(reinterpret_cast<void*>(begin), end - begin, MADV_HUGEPAGE);
+    }
+}
+
+// Square of TILE_SIZE x TILE_SIZE pixels, one bit per pixel.
+struct board_tile_t {
+    uint64_t columns[TILE_SIZE];
+};
+
+// Board split into tiles which are allocated when the first pixel in them
+// is taken. An empty tile is a null pointer in the directory, so checking
+// a pixel is two array lookups whatever the size of the board, and memory
+// grows with the painted area only. Tiles of the previous game are zeroed
+// and reused, so a new game doesn't allocate unless it paints more.
+// Tiles are cut out of anonymous mappings of one huge page size, which are
+// backed by huge pages if asked to.
+class board_t {
+    int width = 0;
+    int height = 0;
+    int tiles_y = 0;
+
+    vector<board_tile_t*> directory;
+    vector<uint32_t> used;
+    vector<board_tile_t*> free_tiles;
+
+    vector<board_tile_t*> chunks;
+    size_t chunk_used = TILES_PER_CHUNK;
+    size_t allocated = 0;
+    bool huge_pages = false;
+
+    size_t tile_index(int x, int y) const {
+        return static_cast<size_t>(x >> TILE_BITS) * tiles_y + (y >> TILE_BITS);
+    }
+
+    // Maps memory for next TILES_PER_CHUNK tiles. Explicit huge pages are tried
+    // first, then transparent ones.
+    void map_chunk() {
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+        void *chunk = huge_pages ? mmap(nullptr, HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0)
+                                 : MAP_FAILED;
+
+        if (chunk == MAP_FAILED) {
+            chunk = mmap(nullptr, HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, flags, -1, 0);
+
+            if (chunk == MAP_FAILED) {
+                cout<<"board memory"<<endl;
+                exit(1);
+            }
+            if (huge_pages) {
+                madvise(chunk, HUGE_PAGE_SIZE, MADV_HUGEPAGE);
+            }
+        }
+
+        chunks.push_back(static_cast<board_tile_t*>(chunk));
+        chunk_used = 0;
+    }
+
+    // Returns a never used tile.
+    board_tile_t *new_tile() {
+        if (chunk_used == TILES_PER_CHUNK) {
+            map_chunk();
+        }
+
+        allocated++;
+        return &chunks.back()[chunk_used++];
+    }
+
+    // Returns an empty tile, reused one if possible.
+    board_tile_t *take_tile() {
+        if (free_tiles.empty()) {
+            return new_tile();
+        }
+
+        board_tile_t *tile = free_tiles.back();
+        free_tiles.pop_back();
+        return tile;
+    }
+
+public:
+    board_t() = default;
+    board_t(const board_t&) = delete;
+    board_t &operator=(const board_t&) = delete;
+
+    ~board_t() {
+        for (board_tile_t *chunk : chunks) {
+            munmap(chunk, HUGE_PAGE_SIZE);
+        }
+    }
+
+    // Tiles mapped from now on will be backed by huge pages where possible.
+    void use_huge_pages(bool enabled) {
+        huge_pages = enabled;
+    }
+
+    // Allocates tiles up to cnt in advance and touches their memory,
+    // so painting them later doesn't page fault.
+    void reserve(size_t cnt) {
+        while (allocated < cnt) {
+            free_tiles.push_back(new_tile());
+            memset(free_tiles.back(), 0, sizeof(board_tile_t));
+        }
+
+        free_tiles.reserve(allocated);
+        used.reserve(allocated);
+    }
+
+    // Empties the board and sets its size.
+    void reset(int new_width, int new_height) {
+        for (uint32_t i : used) {
+            memset(directory[i], 0, sizeof(board_tile_t));
+            free_tiles.push_back(directory[i]);
+            directory[i] = nullptr;
+        }
+        used.clear();
+
+        if (new_width != width || new_height != height) {
+            width = new_width;
+            height = new_height;
+            tiles_y = (height + TILE_MASK) >> TILE_BITS;
+            directory.assign(static_cast<size_t>((width + TILE_MASK) >> TILE_BITS) * tiles_y, nullptr);
+
+            if (huge_pages) {
+                advise_huge_pages(directory.data(), directory.size() * sizeof(board_tile_t*));
+            }
+        }
+    }
+
+    // Checks whether the pixel is taken. Coordinates must lie on the board.
+    bool get(int x, int y) const {
+        const board_tile_t *tile = directory[tile_index(x, y)];
+        return tile != nullptr && (tile->columns[x & TILE_MASK] >> (y & TILE_MASK) & 1);
+    }
+
+    // Marks the pixel as taken. Coordinates must lie on the board.
+    void set(int x, int y) {
+        board_tile_t *&tile = directory[tile_index(x, y)];
+
+        if (tile == nullptr) {
+            tile = take_tile();
+            used.push_back(tile_index(x, y));
+        }
+
+        tile->columns[x & TILE_MASK] |= 1ull << (y & TILE_MASK);
+    }
+
+    // Returns amount of tiles allocated so far.
+    size_t allocated_tiles() const {
+        return allocated;
+    }
+
+};
+
+#endif
@@ -0,0 +1,455 @@
+#include "screen-worms-checkpoint.h"
+#include <csignal>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+static volatile sig_atomic_t terminate_requested = 0;
+
+// Returns current time in microseconds.
+static uint64_t now_us() {
+    timeval tv {};
+    gettimeofday(&tv, nullptr);
+    return tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// Appends values in host order, the file is read only by the same build.
+struct checkpoint_writer_t {
+    vector<uint8_t> &buff;
+
+    void put_bytes(const void *data, size_t len) {
+        auto *bytes = static_cast<const uint8_t*>(data);
+        buff.insert(buff.end(), bytes, bytes + len);
+    }
+
+    template<typename T>
+    void put(const T &value) {
+        static_assert(is_trivially_copyable<T>::value, "checkpointed value must be trivially copyable");
+        put_bytes(&value, sizeof(T));
+    }
+
+    template<typename T>
+    void put_vector(const vector<T> &values) {
+        put<uint64_t>(values.size());
+        put_bytes(values.data(), values.size() * sizeof(T));
+    }
+
+    void put_string(const string &str) {
+        put<uint64_t>(str.size());
+        put_bytes(str.data(), str.size());
+    }
+};
+
+// Reads values written by checkpoint_writer_t. Stops at the first value
+// that doesn't fit in the data and remembers that the checkpoint is broken.
+struct checkpoint_reader_t {
+    const uint8_t *data;
+    size_t size;
+    size_t offset = 0;
+    bool ok = true;
+
+    bool get_bytes(void *out, size_t len) {
+        if (!ok || len > size - offset) {
+            ok = false;
+            return false;
+        }
+
+        memcpy(out, data + offset, len);
+        offset += len;
+        return true;
+    }
+
+    template<typename T>
+    T get() {
+        T value {};
+        get_bytes(&value, sizeof(T));
+        return value;
+    }
+
+    template<typename T>
+    void get_vector(vector<T> &values) {
+        uint64_t cnt = get<uint64_t>();
+
+        if (!ok || cnt > (size - offset) / sizeof(T)) {
+            ok = false;
+            return;
+        }
+
+        values.resize(cnt);
+        get_bytes(values.data(), cnt * sizeof(T));
+    }
+
+    string get_string() {
+        uint64_t len = get<uint64_t>();
+
+        if (!ok || len > size - offset) {
+            ok = false;
+            return "";
+        }
+
+        string str(reinterpret_cast<const char*>(data + offset), len);
+        offset += len;
+        return str;
+    }
+};
+
+static void request_terminate(int) {
+    terminate_requested = 1;
+}
+
+// Encodes everything needed to continue: the running game (whose board is
+// restored from its pixel events), the players with their sessions
+// and the state of random number generator.
+static void encode_state(memory_server_t &mem, vector<uint8_t> &buff) {
+    checkpoint_writer_t out {buff};
+    uint64_t now = now_us();
+
+    out.put<uint64_t>(now);
+    out.put<int32_t>(mem.WIDTH);
+    out.put<int32_t>(mem.HEIGHT);
+    out.put<uint32_t>(mem.game_id);
+    out.put<uint32_t>(mem.rand_state);
+    out.put<int32_t>(mem.worms_alive);
+    out.put<int32_t>(mem.last_event);
+    out.put<uint64_t>(mem.next_message > now ? mem.next_message - now : 0);
+
+    out.put_vector(mem.events.data);
+    out.put_vector(mem.events.offsets);
+
+    worms_t &worms = mem.worms;
+    out.put_vector(worms.pos_x);
+    out.put_vector(worms.pos_y);
+    out.put_vector(worms.direction);
+    out.put_vector(worms.turn_direction);
+    out.put_vector(worms.cell_x);
+    out.put_vector(worms.cell_y);
+    out.put_vector(worms.new_x);
+    out.put_vector(worms.new_y);
+    out.put_vector(worms.eliminated);
+    out.put_vector(worms.bot);
+
+    out.put<uint64_t>(mem.players.size());
+    for (auto &it : mem.players) {
+        player_t &player = it.second;
+
+        out.put_string(it.first);
+        out.put<uint64_t>(player.session_id);
+        out.put<int8_t>(player.turn_direction);
+        out.put_string(player.name);
+        out.put<uint8_t>(player.ready);
+        out.put<int32_t>(player.worm_num);
+        out.put<sockaddr_in6>(player.addr);
+        out.put<uint32_t>(player.datagram_size);
+    }
+}
+
+// Encodes the checkpoint file: header with the length and checksum
+// of the state, followed by the state.
+static void encode_checkpoint(memory_server_t &mem, vector<uint8_t> &buff) {
+    buff.assign(CHECKPOINT_HEADER, 0);
+    encode_state(mem, buff);
+
+    uint8_t *header = &buff[0];
+    header = convert_number_to_bytes(header, CHECKPOINT_MAGIC, DWORD);
+    header = convert_number_to_bytes(header, CHECKPOINT_VERSION, DWORD);
+    header = convert_number_to_bytes(header, buff.size() - CHECKPOINT_HEADER, DWORD);
+    convert_number_to_bytes(header, calculate_crc32(&buff[CHECKPOINT_HEADER], buff.size() - CHECKPOINT_HEADER), DWORD);
+}
+
+// Writes encoded checkpoint next to the old file and renames it.
+static bool write_checkpoint_file(const string &path, const vector<uint8_t> &buff) {
+    string tmp_path = path + ".tmp";
+    int fd = open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    void *file = MAP_FAILED;
+
+    if (fd >= 0 && ftruncate(fd, buff.size()) == 0) {
+        file = mmap(nullptr, buff.size(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+
+    if (file != MAP_FAILED) {
+        memcpy(file, &buff[0], buff.size());
+        munmap(file, buff.size());
+    }
+
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    if (file == MAP_FAILED || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        cout<<"checkpoint file"<<endl;
+        unlink(tmp_path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool write_checkpoint(memory_server_t &mem) {
+    static vector<uint8_t> buff;
+    encode_checkpoint(mem, buff);
+    return write_checkpoint_file(mem.CHECKPOINT_PATH, buff);
+}
+
+// Writes checkpoints handed over by checkpoint_if_due, so the tick thread
+// doesn't wait for the file system.
+static void write_checkpoints(memory_server_t &mem) {
+    checkpoint_thread_t &ct = *mem.checkpoint_thread;
+    unique_lock<mutex> guard(ct.lock);
+
+    while (true) {
+        ct.wake.wait(guard, [&ct] { return ct.busy; });
+        guard.unlock();
+        write_checkpoint_file(mem.CHECKPOINT_PATH, ct.data);
+        guard.lock();
+        ct.busy = false;
+        ct.done.notify_all();
+    }
+}
+
+void install_checkpoint_signals(memory_server_t &mem) {
+    if (mem.CHECKPOINT_PATH.empty() && mem.CAPTURE_PATH.empty()) {
+        return;
+    }
+
+    struct sigaction action {};
+    action.sa_handler = request_terminate;
+    sigemptyset(&action.sa_mask);
+
+    if (sigaction(SIGTERM, &action, nullptr) != 0 || sigaction(SIGINT, &action, nullptr) != 0) {
+        cout<<"signals"<<endl;
+        exit(1);
+    }
+
+    mem.next_checkpoint = now_us() + mem.CHECKPOINT_SPAN * 1000ULL;
+
+    if (!mem.CHECKPOINT_PATH.empty() && mem.CHECKPOINT_SPAN > 0) {
+        mem.checkpoint_thread = make_unique<checkpoint_thread_t>();
+        mem.checkpoint_thread->writer = thread(write_checkpoints, ref(mem));
+        mem.checkpoint_thread->writer.detach();
+    }
+}
+
+void checkpoint_if_due(memory_server_t &mem) {
+    checkpoint_thread_t *ct = mem.checkpoint_thread.get();
+
+    // exit flushes the capture trace as well. The last checkpoint is written
+    // after the periodic one in progress, so that one can't replace it.
+    if (terminate_requested) {
+        if (ct != nullptr) {
+            unique_lock<mutex> guard(ct->lock);
+            ct->done.wait(guard, [ct] { return !ct->busy; });
+        }
+
+        if (!mem.CHECKPOINT_PATH.empty() && !write_checkpoint(mem)) {
+            exit(1);
+        }
+        exit(0);
+    }
+
+    if (ct == nullptr) {
+        return;
+    }
+
+    uint64_t now = now_us();
+
+    if (now < mem.next_checkpoint) {
+        return;
+    }
+
+    // Failed checkpoint is tried again after the next span, the game goes on.
+    // So is one due while the previous is still being written.
+    mem.next_checkpoint = now + mem.CHECKPOINT_SPAN * 1000ULL;
+
+    {
+        lock_guard<mutex> guard(ct->lock);
+
+        if (ct->busy) {
+            return;
+        }
+    }
+
+    encode_checkpoint(mem, ct->spare);
+
+    lock_guard<mutex> guard(ct->lock);
+    swap(ct->data, ct->spare);
+    ct->busy = true;
+    ct->wake.notify_one();
+}
+
+// Paints pixels of all pixel events of the current game on the board.
+static void restore_board(memory_server_t &mem) {
+    clean_board(mem);
+
+    for (size_t i = 0; i < mem.events.size(); i++) {
+        const uint8_t *event = mem.events.event(i);
+        uint64_t offset = 0;
+        auto [len] = event_len_layout::decode(event, offset);
+        auto [event_no, event_type] = event_head_layout::decode(event, offset);
+        (void) len;
+        (void) event_no;
+
+        if (event_type == PIXEL_TYPE && mem.events.event_size(i) == pixel_event::size) {
+            auto [player, x, y] = pixel_layout::decode(event, offset);
+            (void) player;
+
+            if (x < static_cast<uint64_t>(mem.WIDTH) && y < static_cast<uint64_t>(mem.HEIGHT)) {
+                mem.board.set(x, y);
+            }
+        }
+    }
+}
+
+// Decodes state written by encode_state. Returns false if the data is broken,
+// too old to continue (players would have timed out) or the board size
+// has been changed by options.
+static bool decode_state(memory_server_t &mem, checkpoint_reader_t &in) {
+    uint64_t written = in.get<uint64_t>();
+    int32_t width = in.get<int32_t>();
+    int32_t height = in.get<int32_t>();
+    mem.game_id = in.get<uint32_t>();
+    mem.rand_state = in.get<uint32_t>();
+    mem.worms_alive = in.get<int32_t>();
+    mem.last_event = in.get<int32_t>();
+    uint64_t remaining = in.get<uint64_t>();
+
+    if (!in.ok || now_us() - written > TIMEOUT * 1000000ULL || width != mem.WIDTH || height != mem.HEIGHT) {
+        return false;
+    }
+
+    in.get_vector(mem.events.data);
+    in.get_vector(mem.events.offsets);
+
+    worms_t &worms = mem.worms;
+    in.get_vector(worms.pos_x);
+    in.get_vector(worms.pos_y);
+    in.get_vector(worms.direction);
+    in.get_vector(worms.turn_direction);
+    in.get_vector(worms.cell_x);
+    in.get_vector(worms.cell_y);
+    in.get_vector(worms.new_x);
+    in.get_vector(worms.new_y);
+    in.get_vector(worms.eliminated);
+    in.get_vector(worms.bot);
+
+    uint64_t players_cnt = in.get<uint64_t>();
+
+    for (uint64_t i = 0; in.ok && i < players_cnt && i <= MAX_PLAYERS; i++) {
+        string id = in.get_string();
+        player_t player {};
+
+        player.session_id = in.get<uint64_t>();
+        player.turn_direction = in.get<int8_t>();
+        player.name = in.get_string();
+        player.ready = in.get<uint8_t>();
+        player.worm_num = in.get<int32_t>();
+        player.addr = in.get<sockaddr_in6>();
+        player.datagram_size = in.get<uint32_t>();
+
+        // Each player gets a timer, a repeated id would leak one.
+        if (mem.players.count(id) > 0) {
+            return false;
+        }
+
+        player.timer_num = arm_free_timer(mem);
+
+        mem.players[id] = player;
+    }
+
+    count_players(mem);
+
+    for (size_t i = 0; i < mem.events.offsets.size(); i++) {
+        if (mem.events.offsets[i] >= mem.events.data.size()) {
+            return false;
+        }
+    }
+
+    size_t cnt = worms.size();
+    if (!in.ok || worms.pos_y.size() != cnt || worms.direction.size() != cnt ||
+        worms.turn_direction.size() != cnt || worms.cell_x.size() != cnt || worms.cell_y.size() != cnt ||
+        worms.new_x.size() != cnt || worms.new_y.size() != cnt || worms.eliminated.size() != cnt ||
+        worms.bot.size() != cnt || static_cast<size_t>(mem.last_event) > mem.events.size()) {
+        return false;
+    }
+
+    for (auto &it : mem.players) {
+        if (it.second.worm_num < -1 || it.second.worm_num >= static_cast<int>(cnt)) {
+            return false;
+        }
+    }
+
+    restore_board(mem);
+    mem.next_message = now_us() + remaining;
+    return true;
+}
+
+// Forgets partially restored state.
+static void forget_state(memory_server_t &mem) {
+    for (auto &it : mem.players) {
+        mem.used_timers[it.second.timer_num] = false;
+    }
+
+    mem.players.clear();
+    count_players(mem);
+    mem.events.clear();
+    mem.worms.clear();
+    mem.worms_alive = -1;
+    mem.last_event = 0;
+    mem.game_id = 0;
+    mem.rand_state = mem.SEED;
+}
+
+bool restore_checkpoint(memory_server_t &mem) {
+    if (mem.CHECKPOINT_PATH.empty()) {
+        return false;
+    }
+
+    int fd = open(mem.CHECKPOINT_PATH.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat file_stat {};
+    void *file = MAP_FAILED;
+
+    if (fstat(fd, &file_stat) == 0 && file_stat.st_size >= CHECKPOINT_HEADER) {
+        file = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+
+    if (file == MAP_FAILED) {
+        cout<<"checkpoint ignored"<<endl;
+        return false;
+    }
+
+    auto *data = static_cast<const uint8_t*>(file);
+    uint64_t offset = 0;
+    uint32_t magic = convert_bytes_to_number(data, offset, DWORD);
+    uint32_t version = convert_bytes_to_number(data, offset, DWORD);
+    uint32_t len = convert_bytes_to_number(data, offset, DWORD);
+    uint32_t crc = convert_bytes_to_number(data, offset, DWORD);
+
+    bool restored = false;
+
+    if (magic == CHECKPOINT_MAGIC && version == CHECKPOINT_VERSION &&
+        len == file_stat.st_size - CHECKPOINT_HEADER && crc == calculate_crc32(data + CHECKPOINT_HEADER, len)) {
+        checkpoint_reader_t in {data + CHECKPOINT_HEADER, len};
+        restored = decode_state(mem, in);
+    }
+    munmap(file, file_stat.st_size);
+
+    if (!restored) {
+        forget_state(mem);
+        cout<<"checkpoint ignored"<<endl;
+        return false;
+    }
+
+    if (mem.PIPELINED) {
+        send_task_t task {};
+        task.type = TASK_NEW_LOG;
+        task.game_id = mem.game_id;
+        push_task(mem, std::move(task), true);
+    }
+
+    cout<<"restored game "<<mem.game_id<<" with "<<mem.players.size()<<" players"<<endl;
+    return mem.worms_alive > 1;
+}
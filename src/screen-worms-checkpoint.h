@@ -0,0 +1,30 @@
+#ifndef SK_SCREEN_WORMS_CHECKPOINT_H
+#define SK_SCREEN_WORMS_CHECKPOINT_H
+
+#include "screen-worms-server.h"
+
+enum constants_checkpoint {
+    CHECKPOINT_MAGIC = 0x534b5743,
+    CHECKPOINT_VERSION = 1,
+    CHECKPOINT_HEADER = 4 * DWORD,
+};
+
+// Makes SIGTERM write a checkpoint (and flush the capture trace) before
+// the server exits. Starts the thread writing periodic checkpoints.
+void install_checkpoint_signals(memory_server_t &mem);
+
+// Encodes a checkpoint if it's time for a periodic one and hands it over
+// to the writing thread. After SIGTERM writes the last one (if checkpoints
+// are on) and exits. Must be called between ticks.
+void checkpoint_if_due(memory_server_t &mem);
+
+// Writes the whole game state to the checkpoint file. The file is created
+// next to the old one and renamed, so it's never seen half written.
+// Returns false (and leaves the old file) if it couldn't be written.
+bool write_checkpoint(memory_server_t &mem);
+
+// Restores game state from the checkpoint file, if there is a valid and
+// recent one. Returns true if a game was running when it was written.
+bool restore_checkpoint(memory_server_t &mem);
+
+#endif
@@ -1,10 +1,19 @@
 #include "screen-worms-client.h"
 #include "common.h"
 
+// Returns current time in microseconds.
+uint64_t get_time() {
+    timeval tv {};
+    gettimeofday(&tv, nullptr);
+    return tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
 // Creates socket to given address and port. Socket is set not to block
 // and (in terms of TCP) Nagle's algorithm is disabled.
-// Socket is also connected in order to use read and write.
-void create_socket(const char *ip, const char *port, int &sock, bool UDP) {
+// Socket is also connected in order to use read and write. Without wait
+// the connection is only started (see finish_connect).
+// Returns false (with no socket left open) if connecting failed.
+bool create_socket(const char *ip, const char *port, int &sock, bool UDP, bool wait = true) {
     addrinfo addr_hints {};
     addrinfo *addr_result;
     
@@ -53,21 +62,108 @@ void create_socket(const char *ip, const char *port, int &sock, bool UDP) {
         }
     }
 
-    if (connect(sock, addr_result->ai_addr, addr_result->ai_addrlen) < 0) {
-        cout<<"connect"<<endl;
+    if (!wait && fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK) < 0) {
+        cout<<"socket options"<<endl;
         exit(1);
     }
 
+    bool connected = connect(sock, addr_result->ai_addr, addr_result->ai_addrlen) == 0 ||
+                     (!wait && errno == EINPROGRESS);
     freeaddrinfo(addr_result);
+
+    if (!connected) {
+        close(sock);
+        sock = -1;
+    }
+
+    return connected;
+}
+
+// Checks (without waiting) whether connection started by create_socket
+// without wait is finished. Then the socket blocks again like any other.
+// Returns false if it isn't finished yet, sets failed if it won't be.
+bool finish_connect(int sock, bool &failed) {
+    pollfd fd {sock, POLLOUT, 0};
+    int error = 0;
+    socklen_t len = sizeof(error);
+
+    failed = false;
+
+    if (poll(&fd, 1, 0) == 0) {
+        return false;
+    }
+
+    if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error != 0 ||
+        fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) & ~O_NONBLOCK) < 0) {
+        failed = true;
+        return false;
+    }
+
+    return true;
+}
+
+
+// Maps the server's shared memory and takes a free mailbox in it.
+void attach_shm(memory_client_t &mem, const char *name) {
+    if (!map_shm(mem.shm, name, false)) {
+        cout<<"shared memory"<<endl;
+        exit(1);
+    }
+
+    for (int i = 0; i < SHM_MAILBOXES && mem.mailbox < 0; i++) {
+        atomic<int32_t> &owner = mem.shm.header->mailboxes[i].owner;
+        int32_t pid = owner.load();
+
+        if ((pid == 0 || (kill(pid, 0) < 0 && errno == ESRCH)) && owner.compare_exchange_strong(pid, getpid())) {
+            mem.mailbox = i;
+        }
+    }
+
+    if (mem.mailbox < 0) {
+        cout<<"no free mailbox"<<endl;
+        exit(1);
+    }
+
+    mem.server_buff.resize(SHM_BATCH);
+}
+
+// Opens the file into which datagrams from the server are recorded.
+void start_dump(memory_client_t &mem, const char *path) {
+    mem.dump = fopen(path, "wb");
+
+    if (mem.dump == nullptr || setvbuf(mem.dump, nullptr, _IOFBF, TRACE_BUFFER) != 0) {
+        cout<<"dump file"<<endl;
+        exit(1);
+    }
+
+    mem.dump_start = get_time();
+    mem.dump_flushed = mem.dump_start;
+
+    trace_header_t header {DUMP_MAGIC, TRACE_VERSION, mem.dump_start};
+    fwrite(&header, sizeof(header), 1, mem.dump);
 }
 
+// Records one datagram from the server. The file is flushed once in a while,
+// not after every datagram.
+void dump_datagram(memory_client_t &mem, uint8_t *buff, int size) {
+    uint64_t now = get_time();
+    dump_record_t record {now - mem.dump_start, static_cast<uint32_t>(size)};
+
+    fwrite(&record, sizeof(record), 1, mem.dump);
+    fwrite(buff, 1, size, mem.dump);
+
+    if (now - mem.dump_flushed >= TRACE_FLUSH_SPAN) {
+        fflush(mem.dump);
+        mem.dump_flushed = now;
+    }
+}
 
 // Updates options taken from command line. First argument from command line
 // is taken for server's address.
 void update_options(memory_client_t &mem, int argc, char *argv[]) {
     string server_port = "2021";
-    string gui_port = "20210";
-    string gui_ip = "localhost";
+    string shm_name;
+    string dump_path;
     int opt;
 	
 	if (argc < 2) {
@@ -75,7 +171,7 @@ void update_options(memory_client_t &mem, int argc, char *argv[]) {
 		exit(1);
 	}
 	
-    while ((opt = getopt(argc - 1, &argv[1], "n:p:i:r:")) != -1) {
+    while ((opt = getopt(argc - 1, &argv[1], "n:p:i:r:u:t:L:D:B:l:zg")) != -1) {
         if (opt == '?') {
             cout<<"unknown option"<<endl;
             exit(1);
@@ -100,15 +196,80 @@ void update_options(memory_client_t &mem, int argc, char *argv[]) {
             server_port = optarg;
         }
         else if (opt == 'r') {
-            gui_port = optarg;
+            mem.gui_port = optarg;
         }
         else if (opt == 'i') {
-            gui_ip = optarg;
+            mem.gui_ip = optarg;
+        }
+        else if (opt == 'u') {
+            char *ptr;
+            uint32_t size = strtol(optarg, &ptr, 10);
+
+            if (*ptr != 0 || size < MAX_UDP || size > MAX_DATAGRAM) {
+                cout<<"incorrect datagram size"<<endl;
+                exit(1);
+            }
+
+            // Rounded down, so the server never sends more than asked for.
+            mem.datagram_units = min<uint32_t>(UINT8_MAX, max<uint32_t>(1, size / DATAGRAM_UNIT));
+            mem.server_buff.resize(max<uint32_t>(MAX_UDP, mem.datagram_units * DATAGRAM_UNIT));
+        }
+        else if (opt == 'L') {
+            shm_name = optarg;
+        }
+        else if (opt == 'z') {
+            mem.COMPRESSION = true;
+        }
+        else if (opt == 'g') {
+            mem.BINARY_GUI = true;
+        }
+        else if (opt == 'D') {
+            dump_path = optarg;
+        }
+        else if (opt == 'B') {
+            mem.BENCH_PATH = optarg;
+        }
+        else if (opt == 'l') {
+            char *ptr;
+            mem.BENCH_LOOPS = strtol(optarg, &ptr, 10);
+
+            if (*ptr != 0 || mem.BENCH_LOOPS == 0) {
+                cout<<"incorrect benchmark loops"<<endl;
+                exit(1);
+            }
+        }
+        else if (opt == 't') {
+            char *ptr;
+            mem.TELEMETRY_SPAN = strtol(optarg, &ptr, 10);
+
+            if (*ptr != 0) {
+                cout<<"incorrect telemetry span"<<endl;
+                exit(1);
+            }
         }
     }
 	
-    create_socket(argv[1], server_port.c_str(), mem.server_sock, true);
-    create_socket(gui_ip.c_str(), gui_port.c_str(), mem.gui_sock, false);
+    // Benchmark reads neither server nor gui.
+    if (!mem.BENCH_PATH.empty()) {
+        return;
+    }
+
+    if (!dump_path.empty()) {
+        start_dump(mem, dump_path.c_str());
+    }
+
+    if (shm_name.empty() && !create_socket(argv[1], server_port.c_str(), mem.server_sock, true)) {
+        cout<<"connect"<<endl;
+        exit(1);
+    }
+    else if (!shm_name.empty()) {
+        attach_shm(mem, shm_name.c_str());
+    }
+
+    if (!create_socket(mem.gui_ip.c_str(), mem.gui_port.c_str(), mem.gui_sock, false)) {
+        cout<<"connect"<<endl;
+        exit(1);
+    }
 }
 
 // Checks whether given string is prefix of buffer.
@@ -136,24 +297,37 @@ void update_direction(memory_client_t &mem, int arrow) {
     }
 }
 
-// Reads grom gui to buffer untill new line character is encountered. 
-void read_until_new_line(memory_client_t &mem, uint8_t *buff, int &len) {
+// Closes connection to gui, which is tried again every GUI_RETRY_SPAN.
+// Keys of the old gui are no longer held.
+void drop_gui(memory_client_t &mem) {
+    close(mem.gui_sock);
+    mem.gui_sock = -1;
+    mem.direction = STRAIGHT;
+    mem.next_gui_retry = get_time() + GUI_RETRY_SPAN;
+}
+
+// Reads grom gui to buffer untill new line character is encountered.
+// Returns false if gui closed the connection meanwhile.
+bool read_until_new_line(memory_client_t &mem, uint8_t *buff, int &len) {
     while (true) {
         int mess_len = read(mem.gui_sock, buff + len, BYTE);
 
-        if (mess_len <= 0) {
+        if (mess_len == 0) {
+            return false;
+        }
+        if (mess_len < 0) {
             continue;
         }
         len += mess_len;
 
         if (buff[len - 1] == '\n') {
-            break;
+            return true;
         }
     }
 }
 
 // Tries to read from gui. In case of error or no message
-// ignores the read.
+// ignores the read. Closed connection is dropped.
 void read_from_gui(memory_client_t &mem) {
     static uint8_t buff[MAX_TCP] {};
     static string ld = "LEFT_KEY_DOWN";
@@ -164,11 +338,13 @@ void read_from_gui(memory_client_t &mem) {
     int arrow;
     int len = read(mem.gui_sock, buff, lu.size());
 
-    if (len <= 0) {
+    if (len == 0 || (len > 0 && !read_until_new_line(mem, buff, len))) {
+        drop_gui(mem);
+        return;
+    }
+    if (len < 0) {
         return;
     }
-	
-    read_until_new_line(mem, buff, len);
 
     if (check_for_string(buff, ld)) {
         arrow = LD;
@@ -190,44 +366,173 @@ void read_from_gui(memory_client_t &mem) {
     update_direction(mem, arrow);
 }
 
-// Converts given amoutn of bytes from buffer (with offset) from Big Endian to Host.
-// Updates offset of the amount of converted bytes.
-uint64_t convert_bytes_to_number(const uint8_t *buff, uint64_t &offset, int bytes) {
-    uint64_t result = 0;
+// Adds sample if there is still room for it in this summary.
+void add_sample(vector<uint32_t> &samples, uint64_t value) {
+    if (samples.size() < TELEMETRY_MAX_SAMPLES) {
+        samples.push_back(min<uint64_t>(value, UINT32_MAX));
+    }
+}
+
+// Notes that event event_no was taken. Ends waiting for it after
+// a heartbeat or after a gap, and notes arrival of its datagram.
+void note_event(memory_client_t &mem, uint32_t event_no) {
+    telemetry_t &t = mem.telemetry;
+
+    if (mem.TELEMETRY_SPAN == 0) {
+        return;
+    }
+
+    t.events++;
+
+    if (t.heartbeat_pending && t.heartbeat_event_no == event_no) {
+        add_sample(t.heartbeat_latencies, t.now - t.heartbeat_time);
+        t.heartbeat_pending = false;
+    }
+
+    if (t.gap_start != 0) {
+        add_sample(t.gap_recoveries, t.now - t.gap_start);
+        t.gap_start = 0;
+    }
+
+    if (t.last_arrival != t.now) {
+        if (t.last_arrival != 0) {
+            uint64_t interarrival = t.now - t.last_arrival;
+
+            if (t.last_interarrival != 0) {
+                add_sample(t.jitters, max(interarrival, t.last_interarrival) - min(interarrival, t.last_interarrival));
+            }
+            t.last_interarrival = interarrival;
+        }
+        t.last_arrival = t.now;
+    }
+}
+
+// Notes that an event later than the expected one came, so one is missing.
+void note_gap(memory_client_t &mem) {
+    telemetry_t &t = mem.telemetry;
 
-    for (int i = 0; i < bytes; i++) {
-        result *= BYTE_RANGE;
-        result += (buff + offset)[i];
+    if (mem.TELEMETRY_SPAN != 0 && t.gap_start == 0) {
+        t.gap_start = t.now;
+        t.gaps++;
     }
+}
+
+// Returns the given percentile of sorted values.
+uint32_t percentile(vector<uint32_t> &sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+
+    return sorted[min<size_t>(sorted.size() - 1, sorted.size() * p)];
+}
+
+// Prints percentiles (p50, p90, p99, max) of samples with given prefix.
+void print_percentiles(const string &prefix, vector<uint32_t> &samples) {
+    sort(samples.begin(), samples.end());
+
+    cout<<" "<<prefix<<"_samples="<<samples.size()
+        <<" "<<prefix<<"_p50_us="<<percentile(samples, 0.5)
+        <<" "<<prefix<<"_p90_us="<<percentile(samples, 0.9)
+        <<" "<<prefix<<"_p99_us="<<percentile(samples, 0.99)
+        <<" "<<prefix<<"_max_us="<<(samples.empty() ? 0 : samples.back());
+    samples.clear();
+}
 
-    offset += bytes;
-    return result;
+// Prints telemetry gathered since the last summary and starts a new one.
+void report_telemetry(memory_client_t &mem, uint64_t now) {
+    telemetry_t &t = mem.telemetry;
+
+    cout<<"scope=telemetry game_id="<<mem.game_id<<" next_event_no="<<mem.next_event_no<<" events="<<t.events;
+    print_percentiles("heartbeat", t.heartbeat_latencies);
+    print_percentiles("jitter", t.jitters);
+    cout<<" gaps="<<t.gaps;
+    print_percentiles("gap_recovery", t.gap_recoveries);
+    cout<<" stuck_us="<<(t.gap_start ? now - t.gap_start : 0)
+        <<" crc_failures="<<t.crc_failures<<endl;
+
+    t.events = 0;
+    t.gaps = 0;
+    t.crc_failures = 0;
 }
 
 // Checks crc from data of length len.
 bool check_crc(uint8_t *data, uint64_t len) {
-    uint32_t crc = 0xFFFFFFFF;
+    uint32_t crc = calculate_crc32(data, len);
+    auto [mess_crc] = crc_layout::decode(data, len);
 
-    for (uint64_t i = 0; i < len; i++) {
-        uint64_t temp = (crc ^ data[i]) & 0xFF;
-        crc = (crc >> 8) ^ crc32_tab[temp];
+    return (crc == mess_crc);
+}
+
+// Writes parsed events (one, or a frame of them in binary mode) to gui.
+// Without gui (in benchmark, or while it's reconnected) they're only
+// counted. Gui which went away doesn't stop the client (send doesn't
+// raise SIGPIPE).
+void write_to_gui(memory_client_t &mem, uint8_t *mess, size_t len, size_t events = 1) {
+    mem.gui_events += events;
+    mem.gui_bytes += len;
+
+    if (mem.gui_sock >= 0 && !mem.gui_connecting && send(mem.gui_sock, mess, len, MSG_NOSIGNAL) == -1) {
+        drop_gui(mem);
     }
+}
 
-    crc = crc ^ 0xFFFFFFFF;
+// Appends frame with cached events from given one on.
+void append_gui_records(memory_client_t &mem, vector<uint8_t> &out, size_t from) {
+    size_t cnt = mem.gui_cache.size() - from;
+    gui_frame_head_t head {htole32(cnt * sizeof(gui_record_t)), GUI_EVENTS};
+    size_t pos = out.size();
 
-    uint32_t mess_crc = convert_bytes_to_number(data, len, DWORD);
-    return (crc == mess_crc);
+    out.resize(pos + sizeof(head) + cnt * sizeof(gui_record_t));
+    memcpy(&out[pos], &head, sizeof(head));
+    pos += sizeof(head);
+
+    for (size_t i = from; i < mem.gui_cache.size(); i++, pos += sizeof(gui_record_t)) {
+        gui_event_t &event = mem.gui_cache[i];
+        gui_record_t record {event.type, event.player, htole16(event.x), htole16(event.y)};
+        memcpy(&out[pos], &record, sizeof(record));
+    }
+}
+
+// In binary mode writes events parsed since the last flush as one frame.
+void flush_gui_records(memory_client_t &mem) {
+    if (!mem.BINARY_GUI || mem.gui_flushed == mem.gui_cache.size()) {
+        return;
+    }
+
+    mem.gui_frame.clear();
+    append_gui_records(mem, mem.gui_frame, mem.gui_flushed);
+    write_to_gui(mem, mem.gui_frame.data(), mem.gui_frame.size(), mem.gui_cache.size() - mem.gui_flushed);
+    mem.gui_flushed = mem.gui_cache.size();
+}
+
+// Lines for gui of events of current game, also used for replaying the cache.
+string render_PIXEL(memory_client_t &mem, uint32_t x, uint32_t y, uint8_t player) {
+    return "PIXEL " + to_string(x) + " " + to_string(y) + " " + mem.player_names[player] + "\n";
+}
+
+string render_ELIMINATED(memory_client_t &mem, uint8_t player) {
+    return "PLAYER_ELIMINATED " + mem.player_names[player] + "\n";
+}
+
+string render_NEW_GAME(memory_client_t &mem) {
+    string str = "NEW_GAME " + to_string(mem.max_x) + " " + to_string(mem.max_y);
+
+    for (uint32_t i = 0; i < mem.players_cnt; i++) {
+        str += " " + mem.player_names[i];
+    }
+
+    return str + "\n";
 }
 
 // Returns parsed PIXEL event for gui. Moves offset to the next event.
 string parse_PIXEL(memory_client_t &mem, uint8_t *buff, uint64_t &offset) {
-    uint8_t player = convert_bytes_to_number(buff, offset, BYTE);
-    uint32_t x = convert_bytes_to_number(buff, offset, DWORD);
-    uint32_t y = convert_bytes_to_number(buff, offset, DWORD);
-	
+    auto [player, x, y] = pixel_layout::decode(buff, offset);
+
     if (player < mem.players_cnt && x < mem.max_x && y < mem.max_y) {
-        offset += DWORD;
-        return "PIXEL " + to_string(x) + " " + to_string(y) + " " + mem.player_names[player] + "\n";
+        offset += crc_layout::size;
+        mem.gui_cache.push_back({static_cast<uint32_t>(x), static_cast<uint32_t>(y), PIXEL_TYPE,
+                                 static_cast<uint8_t>(player)});
+        return mem.BINARY_GUI ? string() : render_PIXEL(mem, x, y, player);
     }
 
     cout<<"wrong pixel event"<<endl;
@@ -236,11 +541,12 @@ string parse_PIXEL(memory_client_t &mem, uint8_t *buff, uint64_t &offset) {
 
 // Returns parsed PLAYER ELIMINATED event for gui. Moves offset to the next event.
 string parse_ELIMINATED(memory_client_t &mem, uint8_t *buff, uint64_t &offset) {
-    uint8_t player = convert_bytes_to_number(buff, offset, BYTE);
+    auto [player] = eliminated_layout::decode(buff, offset);
 
     if (player < mem.players_cnt) {
-        offset += DWORD;
-        return "PLAYER_ELIMINATED " + mem.player_names[player] + "\n";
+        offset += crc_layout::size;
+        mem.gui_cache.push_back({0, 0, ELIMINATED_TYPE, static_cast<uint8_t>(player)});
+        return mem.BINARY_GUI ? string() : render_ELIMINATED(mem, player);
     }
 
     cout<<"wrong player eliminated event"<<endl;
@@ -269,30 +575,44 @@ string parse_player_name(uint8_t *buff, uint64_t &offset) {
 }
 
 // Returns parsed NEW GAME event for gui. Moves offset to the next event.
+// Cache of the previous game's events is dropped (in binary mode after
+// the ones not yet written are flushed).
 string parse_NEW_GAME(memory_client_t &mem, uint8_t *buff, uint64_t &offset, uint64_t end_of_list) {
-    uint32_t max_x = convert_bytes_to_number(buff, offset, DWORD);
-    uint32_t max_y = convert_bytes_to_number(buff, offset, DWORD);
+    auto [max_x, max_y] = new_game_layout::decode(buff, offset);
     int player_cnt = 0;
-    string str = "NEW_GAME " + to_string(max_x) + " " + to_string(max_y);
+
+    if (mem.BINARY_GUI && (max_x > GUI_MAX_COORD || max_y > GUI_MAX_COORD)) {
+        cout<<"board too big for binary gui"<<endl;
+        exit(1);
+    }
 	
     while (offset < end_of_list) {
-        mem.player_names[player_cnt] = parse_player_name(buff, offset);
-        str += " " + mem.player_names[player_cnt];
-        player_cnt++;
-		
-        if (player_cnt > MAX_PLAYERS) {
+        if (player_cnt == MAX_WORMS) {
             cout<<"too many players"<<endl;
             exit(1);
         }
+
+        mem.player_names[player_cnt] = parse_player_name(buff, offset);
+        player_cnt++;
     }
 
     offset += DWORD;
     mem.players_cnt = player_cnt;
     mem.max_x = max_x;
     mem.max_y = max_y;
-    str += "\n";
+
+    flush_gui_records(mem);
+    mem.gui_cache.clear();
+    mem.gui_flushed = 0;
+    mem.gui_cache_game = true;
+
+    if (mem.BINARY_GUI) {
+        vector<uint8_t> frame;
+        encode_gui_new_game(frame, mem.max_x, mem.max_y, mem.player_names, mem.players_cnt);
+        return string(frame.begin(), frame.end());
+    }
     
-    return str;
+    return render_NEW_GAME(mem);
 }
 
 // Parses one whole event for gui. Uses arithmetics for server messages.
@@ -301,20 +621,25 @@ string parse_event(memory_client_t &mem, uint8_t* buff, uint64_t &offset, uint64
         return "ignore";
     }
 	
-	uint32_t len = convert_bytes_to_number(buff, offset, DWORD);
+    auto [len] = event_len_layout::decode(buff, offset);
     	
-	if (len < DWORD + BYTE || len + 2 * DWORD > size) {
+	if (len < DWORD + BYTE || offset + len + DWORD > size) {
     	return "ignore";
 	}
 	
-    if (check_crc(buff + offset - DWORD, len + DWORD)) {
-        uint32_t event_no = convert_bytes_to_number(buff, offset, DWORD);
-        uint8_t event_type = convert_bytes_to_number(buff, offset, BYTE);
+    // Events in shared memory come straight from the server, they aren't checked.
+    if (mem.shm.header != nullptr || check_crc(buff + offset - DWORD, len + DWORD)) {
+        auto [event_no, event_type] = event_head_layout::decode(buff, offset);
 		
         if (event_no != mem.next_event_no) {
+            if (event_no > mem.next_event_no) {
+                note_gap(mem);
+            }
+
             return "ignore";
         }
 
+        note_event(mem, event_no);
         mem.next_event_no++;
 
         if (event_type == NEW_GAME_TYPE) {           
@@ -325,13 +650,13 @@ string parse_event(memory_client_t &mem, uint8_t* buff, uint64_t &offset, uint64
 
             return parse_NEW_GAME(mem, buff, offset, offset + len - DWORD - BYTE);
         }
-        else if (event_type == PIXEL_TYPE && len == PIXEL_LENGTH) {
+        else if (event_type == PIXEL_TYPE && len == pixel_event::len) {
             return parse_PIXEL(mem, buff, offset);
         }
-        else if (event_type == ELIMINATED_TYPE && len == ELIMINATED_LENGTH) {
+        else if (event_type == ELIMINATED_TYPE && len == eliminated_event::len) {
             return parse_ELIMINATED(mem, buff, offset);
         }
-        else if (event_type == GAME_OVER_TYPE && len == GAME_OVER_LENGTH) {
+        else if (event_type == GAME_OVER_TYPE && len == game_over_event::len) {
             offset += DWORD;
             
             return "game over";
@@ -343,34 +668,105 @@ string parse_event(memory_client_t &mem, uint8_t* buff, uint64_t &offset, uint64
         }
     }
     else {
+        mem.telemetry.crc_failures++;
         return "ignore";
     }
 }
 
-// Reads one whole message from server. Returns true if we were able to read any bytes.
-bool read_from_server(memory_client_t &mem) {
-    static uint8_t buff[MAX_UDP];
+// Starts connecting to gui again, without stalling the game meanwhile.
+void reconnect_gui(memory_client_t &mem) {
+    if (!create_socket(mem.gui_ip.c_str(), mem.gui_port.c_str(), mem.gui_sock, false, false)) {
+        mem.next_gui_retry = get_time() + GUI_RETRY_SPAN;
+        return;
+    }
+
+    mem.gui_connecting = true;
+}
+
+// Once the connection to gui is made, replays the current game to it from
+// the cache, so the new gui catches up without asking the server for anything.
+void replay_to_gui(memory_client_t &mem) {
+    bool failed;
+
+    if (!finish_connect(mem.gui_sock, failed)) {
+        if (failed) {
+            mem.gui_connecting = false;
+            drop_gui(mem);
+        }
+        return;
+    }
+
+    mem.gui_connecting = false;
+
+    if (!mem.gui_cache_game) {
+        return;
+    }
+
+    if (mem.BINARY_GUI) {
+        vector<uint8_t> frames;
+        encode_gui_new_game(frames, mem.max_x, mem.max_y, mem.player_names, mem.players_cnt);
+        append_gui_records(mem, frames, 0);
+
+        if (send(mem.gui_sock, frames.data(), frames.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(frames.size())) {
+            drop_gui(mem);
+        }
+        return;
+    }
+
+    string text = render_NEW_GAME(mem);
 
+    for (gui_event_t &event : mem.gui_cache) {
+        if (event.type == PIXEL_TYPE) {
+            text += render_PIXEL(mem, event.x, event.y, event.player);
+        }
+        else {
+            text += render_ELIMINATED(mem, event.player);
+        }
+    }
+
+    if (send(mem.gui_sock, text.data(), text.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(text.size())) {
+        drop_gui(mem);
+    }
+}
+
+// Passes events of one message from server to gui.
+void handle_server_mess(memory_client_t &mem, uint8_t *buff, int size) {
     uint64_t offset = 0;
-    memset(buff, 0, sizeof(buff));
-    int size = read(mem.server_sock, buff, sizeof(buff));
-	
-    if (size <= 0) {
-    	return false;
+
+    if (mem.dump != nullptr) {
+        dump_datagram(mem, buff, size);
     }
-    else if (size < DWORD * DWORD) {
-        return true;
+
+    if (is_compressed(buff, size)) {
+        size = decompress_events(mem.decompress_scratch, buff, size, &mem.decompressed[0], mem.decompressed.size());
+
+        if (size < 0) {
+            mem.telemetry.crc_failures++;
+            return;
+        }
+
+        buff = &mem.decompressed[0];
+    }
+
+    if (size < DWORD * DWORD) {
+        return;
+    }
+
+    if (mem.TELEMETRY_SPAN != 0) {
+        mem.telemetry.now = get_time();
     }
 	
-    uint32_t game_id = convert_bytes_to_number(buff, offset, DWORD);
+    auto [game_id] = game_id_layout::decode(buff, offset);
 
     if (buff[3 * DWORD] == NEW_GAME_TYPE && game_id != mem.game_id) {  
         mem.game_id = game_id;
         mem.next_event_no = 0;
+        mem.telemetry.gap_start = 0;
+        mem.telemetry.heartbeat_pending = false;
     }
 
     if (mem.game_id != game_id) {
-        return true;
+        return;
     }
 
     while (offset < static_cast<uint64_t>(size)) {
@@ -378,31 +774,111 @@ bool read_from_server(memory_client_t &mem) {
         auto *mess = reinterpret_cast<uint8_t*>(&result[0]);
 
         if (result == "ignore") {
-            return true;
+            break;
         }
         else if (result == "type") {
             continue;
         }
-        else if (result != "game over") {
-            if (write(mem.gui_sock, mess, result.size()) == -1) {
-                cout<<"write to gui"<<endl;
-                exit(1);
-            }
+        else if (result != "game over" && !result.empty()) {
+            write_to_gui(mem, mess, result.size());
         }
     }
-    
+
+    flush_gui_records(mem);
+}
+
+// Reads one whole message from server. Returns true if we were able to read any bytes.
+bool read_from_server(memory_client_t &mem) {
+    int size = read(mem.server_sock, &mem.server_buff[0], mem.server_buff.size());
+
+    if (size <= 0) {
+    	return false;
+    }
+
+    handle_server_mess(mem, &mem.server_buff[0], size);
     return true;
 }
 
-// Sends one message with current arrow pressed to server.
+// Reads events of one game from the server's ring into a message like one
+// from the server and handles it. The copy is used only if the server hadn't
+// started overwriting the events while they were copied. Returns true if
+// there were any new events.
+bool read_from_shm(memory_client_t &mem) {
+    shm_header_t &header = *mem.shm.header;
+    uint64_t head = header.head_events.load(memory_order_acquire);
+
+    if (mem.shm_next == UINT64_MAX) {
+        mem.shm_next = header.game_first.load(memory_order_acquire);
+    }
+
+    if (mem.shm_next >= head) {
+        return false;
+    }
+
+    uint8_t *buff = &mem.server_buff[0];
+    uint64_t first = mem.shm_next;
+    uint64_t first_pos = mem.shm.entries[first % SHM_RING_EVENTS].pos;
+    uint32_t game_id = mem.shm.entries[first % SHM_RING_EVENTS].game_id;
+    size_t size = game_id_layout::encode(buff, game_id) - buff;
+
+    for (; mem.shm_next < head; mem.shm_next++) {
+        shm_event_t entry = mem.shm.entries[mem.shm_next % SHM_RING_EVENTS];
+
+        if (entry.game_id != game_id || entry.size > SHM_MAX_EVENT ||
+            size + entry.size > mem.server_buff.size()) {
+            break;
+        }
+
+        memcpy(buff + size, mem.shm.bytes + entry.pos % SHM_RING_BYTES, entry.size);
+        size += entry.size;
+    }
+
+    atomic_thread_fence(memory_order_acquire);
+
+    if (header.head_events.load(memory_order_relaxed) - first >= SHM_RING_EVENTS ||
+        header.head_bytes.load(memory_order_relaxed) + 2 * SHM_MAX_EVENT - first_pos > SHM_RING_BYTES) {
+        cout<<"shared memory overrun"<<endl;
+        exit(1);
+    }
+
+    handle_server_mess(mem, buff, size);
+    return true;
+}
+
+// Sends one message with current arrow pressed to server. If bigger datagrams
+// or compression are wanted, the whole message with padding byte and flags is sent.
 void send_to_server(memory_client_t &mem) {
     client_mess_t mess {};
     mess.session_id = htobe64(mem.session_id);
     mess.turn_direction = mem.direction;
     mess.next_expected_event_no = htobe32(mem.next_event_no);
     memcpy(mess.player_name, &mem.name[0], mem.name.size());
-	
-    if (write(mem.server_sock, &mess, MESS_BASIC_LEN + mem.name.size()) == -1) {
+    mess.padding = mem.datagram_units;
+    mess.flags = mem.COMPRESSION ? CLIENT_COMPRESSION : 0;
+
+    // Latency of an event is measured from the first heartbeat asking for it.
+    telemetry_t &t = mem.telemetry;
+    if (mem.TELEMETRY_SPAN != 0 && !(t.heartbeat_pending && t.heartbeat_event_no == mem.next_event_no)) {
+        t.heartbeat_time = get_time();
+        t.heartbeat_event_no = mem.next_event_no;
+        t.heartbeat_pending = true;
+    }
+
+    size_t len = MESS_BASIC_LEN + mem.name.size();
+    if (mem.datagram_units != 0 || mem.COMPRESSION) {
+        len = sizeof(client_mess_t);
+    }
+
+    if (mem.shm.header != nullptr) {
+        shm_mailbox_t &mailbox = mem.shm.header->mailboxes[mem.mailbox];
+        uint32_t seq = mailbox.seq.load(memory_order_relaxed);
+
+        mailbox.seq.store(seq + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        memcpy(&mailbox.mess, &mess, sizeof(mess));
+        mailbox.seq.store(seq + 2, memory_order_release);
+    }
+    else if (write(mem.server_sock, &mess, len) == -1) {
         cout<<"write server"<<endl;
         exit(1);
     }
@@ -420,17 +896,95 @@ void play(memory_client_t &mem) {
             send_to_server(mem);
             mem.next_message += MESSAGE_SPAN;
         }
+
+        if (mem.TELEMETRY_SPAN != 0 && mem.next_report <= t) {
+            report_telemetry(mem, t);
+            mem.next_report = t + mem.TELEMETRY_SPAN * 1000ULL;
+        }
         
-		read_from_gui(mem);
+        if (mem.gui_sock < 0 && mem.next_gui_retry <= t) {
+            reconnect_gui(mem);
+        }
+        if (mem.gui_connecting) {
+            replay_to_gui(mem);
+        }
+        else if (mem.gui_sock >= 0) {
+            read_from_gui(mem);
+        }
 		
         for (int i = 0; i < SERVER_AT_ONCE; i++) {
-        	if (!read_from_server(mem)) {
+        	if (!(mem.shm.header ? read_from_shm(mem) : read_from_server(mem))) {
         		break;
         	}
         }
     }
 }
 
+// Reads datagrams recorded with -D.
+vector<vector<uint8_t>> load_dump(const string &path) {
+    ifstream in(path, ios::binary);
+    trace_header_t header {};
+    vector<vector<uint8_t>> datagrams;
+
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        header.magic != DUMP_MAGIC || header.version != TRACE_VERSION) {
+        cout<<"incorrect dump"<<endl;
+        exit(1);
+    }
+
+    dump_record_t record {};
+
+    while (in.read(reinterpret_cast<char*>(&record), sizeof(record))) {
+        vector<uint8_t> datagram(record.len);
+
+        if (record.len > MAX_DATAGRAM ||
+            !in.read(reinterpret_cast<char*>(datagram.data()), record.len)) {
+            break;
+        }
+
+        datagrams.push_back(move(datagram));
+    }
+
+    return datagrams;
+}
+
+// Measures the client's side of receiving: every recorded datagram goes
+// through handle_server_mess (parsing and crc checks) into the null gui, as if
+// read_from_server had just read it. The state of the client is reset before
+// each loop so the games are parsed again rather than ignored as old.
+void benchmark(memory_client_t &mem) {
+    vector<vector<uint8_t>> datagrams = load_dump(mem.BENCH_PATH);
+    uint64_t bytes = 0;
+
+    for (vector<uint8_t> &datagram : datagrams) {
+        bytes += datagram.size();
+        mem.server_buff.resize(max(mem.server_buff.size(), datagram.size()));
+    }
+
+    uint64_t start = get_time();
+
+    for (uint32_t loop = 0; loop < mem.BENCH_LOOPS; loop++) {
+        mem.game_id = 0;
+        mem.next_event_no = 0;
+
+        for (vector<uint8_t> &datagram : datagrams) {
+            memcpy(&mem.server_buff[0], datagram.data(), datagram.size());
+            handle_server_mess(mem, &mem.server_buff[0], datagram.size());
+        }
+    }
+
+    uint64_t duration = max<uint64_t>(get_time() - start, 1);
+    uint64_t events = mem.gui_events;
+
+    cout<<"datagrams="<<datagrams.size() * mem.BENCH_LOOPS<<" loops="<<mem.BENCH_LOOPS
+        <<" input_bytes="<<bytes * mem.BENCH_LOOPS<<" events="<<events
+        <<" crc_failures="<<mem.telemetry.crc_failures<<" duration_us="<<duration
+        <<" events_per_s="<<events * 1000000 / duration
+        <<" ns_per_event="<<(events ? duration * 1000 / events : 0)
+        <<" gui_bytes="<<mem.gui_bytes
+        <<" gui_bytes_per_event="<<fixed<<setprecision(2)<<(events ? double(mem.gui_bytes) / events : 0)<<endl;
+}
+
 int main(int argc, char *argv[]) {
     memory_client_t mem {};
     timeval tv {};
@@ -441,6 +995,13 @@ int main(int argc, char *argv[]) {
 	mem.next_message = mem.session_id + MESSAGE_SPAN;
 	
     update_options(mem, argc, argv);
+
+    if (!mem.BENCH_PATH.empty()) {
+        benchmark(mem);
+        return 0;
+    }
+
+    mem.next_report = mem.session_id + mem.TELEMETRY_SPAN * 1000ULL;
     
     play(mem);
 }
@@ -15,6 +15,10 @@
 #include <endian.h>
 
 #include "common.h"
+#include "screen-worms-shm.h"
+#include "screen-worms-trace.h"
+#include "screen-worms-compress.h"
+#include "screen-worms-gui.h"
 
 using namespace std;
 
@@ -29,6 +33,44 @@ enum constants_client {
     
     SERVER_AT_ONCE = 10,
     MAX_TCP = 14,
+
+    TELEMETRY_MAX_SAMPLES = 1 << 16,
+
+    SHM_BATCH = 1 << 16,
+
+    GUI_RETRY_SPAN = 200000,
+};
+
+// Timings (in microseconds) gathered since the last telemetry summary.
+// Heartbeat latency is measured from the first message asking for an event
+// to the arrival of that event, jitter is the change of time between
+// consecutive datagrams bringing new events, and gap recovery is how long
+// the client waited for a missing event after seeing later ones.
+struct telemetry_t {
+    uint64_t now = 0;
+
+    uint64_t heartbeat_time = 0;
+    uint32_t heartbeat_event_no = 0;
+    bool heartbeat_pending = false;
+
+    uint64_t last_arrival = 0;
+    uint64_t last_interarrival = 0;
+    uint64_t gap_start = 0;
+
+    uint64_t events = 0;
+    uint64_t gaps = 0;
+    uint64_t crc_failures = 0;
+    vector<uint32_t> heartbeat_latencies;
+    vector<uint32_t> jitters;
+    vector<uint32_t> gap_recoveries;
+};
+
+// Parsed event of current game kept for replaying to a reconnected gui.
+struct gui_event_t {
+    uint32_t x;
+    uint32_t y;
+    uint8_t type;
+    uint8_t player;
 };
 
 struct memory_client_t {
@@ -38,6 +80,21 @@ struct memory_client_t {
 
     int server_sock = -1;
     int gui_sock = -1;
+    string gui_ip = "localhost";
+    string gui_port = "20210";
+
+    // Gui which went away is connected to again at next_gui_retry
+    // and gets the current game from the cache once gui_connecting ends.
+    uint64_t next_gui_retry = 0;
+    bool gui_connecting = false;
+    bool gui_cache_game = false;
+    vector<gui_event_t> gui_cache;
+
+    // Binary gui (see screen-worms-gui.h) gets cached events from
+    // gui_flushed on as one frame per datagram from server.
+    bool BINARY_GUI = false;
+    size_t gui_flushed = 0;
+    vector<uint8_t> gui_frame;
 
     uint32_t game_id = 0;
     uint32_t next_event_no = 0;
@@ -47,7 +104,38 @@ struct memory_client_t {
     uint32_t max_y = 0;
     uint64_t next_message = 0;
 
-    string player_names[MAX_PLAYERS] {};
+    uint32_t TELEMETRY_SPAN = 0;
+    uint64_t next_report = 0;
+    telemetry_t telemetry;
+
+    // Local transport: events are read from the server's ring and messages
+    // are left in a mailbox (see screen-worms-shm.h).
+    shm_t shm;
+    int mailbox = -1;
+    uint64_t shm_next = UINT64_MAX;
+
+    // Datagrams from the server are recorded into dump if asked to.
+    FILE *dump = nullptr;
+    uint64_t dump_start = 0;
+    uint64_t dump_flushed = 0;
+
+    // Benchmark mode replays a dump BENCH_LOOPS times into a null gui,
+    // which only counts what would be written.
+    string BENCH_PATH;
+    uint32_t BENCH_LOOPS = 1;
+    uint64_t gui_events = 0;
+    uint64_t gui_bytes = 0;
+
+    uint8_t datagram_units = 0;
+    vector<uint8_t> server_buff = vector<uint8_t>(MAX_UDP);
+
+    // Compressed catch-up is asked for and restored here before parsing.
+    bool COMPRESSION = false;
+    vector<uint8_t> decompressed = vector<uint8_t>(game_id_layout::size + COMPRESS_MAX_RAW);
+    vector<uint8_t> decompress_scratch = vector<uint8_t>(COMPRESS_MAX_RAW);
+
+    // Players and (in arena mode) bots of current game.
+    string player_names[MAX_WORMS] {};
 };
 
 #endif
@@ -0,0 +1,342 @@
+#include "screen-worms-compress.h"
+
+using namespace std;
+
+using compressed_head_layout = layout_t<DWORD, DWORD, DWORD>;     // mark, transformed size, crc32 of events
+using run_layout = layout_t<DWORD, 2 * BYTE>;                       // len, amount of events
+
+static_assert(game_id_layout::size + compressed_head_layout::size == COMPRESSED_HEAD, "compressed head");
+
+// Offsets of fields within event's data (after len).
+enum constants_delta {
+    DELTA_TYPE = DWORD,
+    DELTA_PLAYER = event_head_layout::size,
+    DELTA_X = DELTA_PLAYER + BYTE,
+    DELTA_Y = DELTA_X + DWORD,
+};
+
+// What fields are coded against within one datagram: number of the next
+// event and the last pixel of every player.
+struct delta_state_t {
+    uint32_t next_event_no = 0;
+    uint32_t x[BYTE_RANGE] {};
+    uint32_t y[BYTE_RANGE] {};
+};
+
+// Maps small differences of either sign to small numbers.
+static uint32_t zigzag(uint32_t delta) {
+    return (delta << 1) ^ -(delta >> 31);
+}
+
+static uint32_t unzigzag(uint32_t value) {
+    return (value >> 1) ^ -(value & 1);
+}
+
+// Reads or writes Big Endian number with bytes lying stride apart.
+static uint32_t get_column(const uint8_t *col, size_t stride) {
+    return (col[0] << 24) | (col[stride] << 16) | (col[2 * stride] << 8) | col[3 * stride];
+}
+
+static void put_column(uint8_t *col, size_t stride, uint32_t value) {
+    for (int i = DWORD - 1; i >= 0; i--, value >>= 8) {
+        col[i * stride] = value;
+    }
+}
+
+// Returns true if data of given len is PIXEL event's.
+static bool is_pixel(const uint8_t *data, uint64_t len) {
+    return len == pixel_event::len && data[DELTA_TYPE] == PIXEL_TYPE;
+}
+
+// Writes coded data of one event into a column (its bytes stride apart).
+static void encode_row(delta_state_t &state, const uint8_t *data, uint64_t len, uint8_t *col, size_t stride) {
+    uint64_t offset = 0;
+    auto [event_no, event_type] = event_head_layout::decode(data, offset);
+    (void) event_type;
+
+    for (uint64_t i = 0; i < len; i++) {
+        col[i * stride] = data[i];
+    }
+
+    put_column(col, stride, zigzag(event_no - state.next_event_no));
+    state.next_event_no = event_no + 1;
+
+    if (is_pixel(data, len)) {
+        auto [player, x, y] = pixel_layout::decode(data, offset);
+
+        put_column(col + DELTA_X * stride, stride, zigzag(x - state.x[player]));
+        put_column(col + DELTA_Y * stride, stride, zigzag(y - state.y[player]));
+        state.x[player] = x;
+        state.y[player] = y;
+    }
+}
+
+// Restores data of one event from its column.
+static void decode_row(delta_state_t &state, const uint8_t *col, size_t stride, uint64_t len, uint8_t *data) {
+    for (uint64_t i = 0; i < len; i++) {
+        data[i] = col[i * stride];
+    }
+
+    uint32_t event_no = unzigzag(get_column(col, stride)) + state.next_event_no;
+    convert_number_to_bytes(data, event_no, DWORD);
+    state.next_event_no = event_no + 1;
+
+    if (is_pixel(data, len)) {
+        uint8_t player = data[DELTA_PLAYER];
+        state.x[player] += unzigzag(get_column(col + DELTA_X * stride, stride));
+        state.y[player] += unzigzag(get_column(col + DELTA_Y * stride, stride));
+
+        convert_number_to_bytes(data + DELTA_X, state.x[player], DWORD);
+        convert_number_to_bytes(data + DELTA_Y, state.y[player], DWORD);
+    }
+}
+
+// Transforms events for the LZ block. Events are taken in runs of the same
+// len, every run is written as its len, amount of events and their data
+// column by column (the first bytes of all events, then the second ones...).
+// Crc of every event is dropped, event_no is stored as difference from the
+// expected one and pixel's coordinates as difference from the player's
+// previous pixel, so columns of a run of PIXEL events are mostly zeros.
+// Returns transformed size.
+static size_t transform(const uint8_t *events, size_t len, uint8_t *out) {
+    delta_state_t state;
+    uint8_t *begin = out;
+
+    for (uint64_t pos = 0; pos < len; ) {
+        uint64_t offset = pos;
+        auto [event_len] = event_len_layout::decode(events, offset);
+        size_t event_size = event_len_layout::size + event_len + crc_layout::size;
+        size_t cnt = 1;
+
+        while (pos + cnt * event_size < len && cnt < UINT16_MAX) {
+            uint64_t next = pos + cnt * event_size;
+
+            if (event_len_layout::decode(events, next)[0] != event_len) {
+                break;
+            }
+            cnt++;
+        }
+
+        out = run_layout::encode(out, event_len, cnt);
+
+        for (size_t r = 0; r < cnt; r++) {
+            encode_row(state, events + pos + r * event_size + event_len_layout::size, event_len, out + r, cnt);
+        }
+
+        out += event_len * cnt;
+        pos += event_size * cnt;
+    }
+
+    return out - begin;
+}
+
+// Writes length of literals or match above what fits in the token.
+static void write_run(uint8_t *out, size_t &o, size_t len) {
+    if (len < COMPRESS_RUN_MASK) {
+        return;
+    }
+
+    for (len -= COMPRESS_RUN_MASK; len >= UINT8_MAX; len -= UINT8_MAX) {
+        out[o++] = UINT8_MAX;
+    }
+
+    out[o++] = len;
+}
+
+// Reads length written by write_run. Returns false if input ends too soon.
+static bool read_run(const uint8_t *in, size_t n, size_t &i, size_t &len) {
+    if (len < COMPRESS_RUN_MASK) {
+        return true;
+    }
+
+    uint8_t byte;
+
+    do {
+        if (i >= n) {
+            return false;
+        }
+
+        byte = in[i++];
+        len += byte;
+    } while (byte == UINT8_MAX);
+
+    return true;
+}
+
+// Writes one sequence: literals and then match of given offset (none if
+// match is 0). Returns false if it doesn't fit in cap.
+static bool write_sequence(uint8_t *out, size_t &o, size_t cap, const uint8_t *literals, size_t literals_len,
+                           size_t offset, size_t match) {
+    size_t match_code = match ? match - COMPRESS_MIN_MATCH : 0;
+
+    if (o + 3 + literals_len + literals_len / UINT8_MAX + 2 + match_code / UINT8_MAX + 1 > cap) {
+        return false;
+    }
+
+    out[o++] = (min<size_t>(literals_len, COMPRESS_RUN_MASK) << 4) | min<size_t>(match_code, COMPRESS_RUN_MASK);
+    write_run(out, o, literals_len);
+    memcpy(out + o, literals, literals_len);
+    o += literals_len;
+
+    if (match != 0) {
+        out[o++] = offset >> 8;
+        out[o++] = offset & UINT8_MAX;
+        write_run(out, o, match_code);
+    }
+
+    return true;
+}
+
+// Greedy LZ77 with a hash table of the last positions of 4-byte sequences.
+// Returns size of the block or 0 if it doesn't fit in cap.
+static size_t lz_compress(uint32_t *table, const uint8_t *in, size_t n, uint8_t *out, size_t cap) {
+    size_t anchor = 0;
+    size_t o = 0;
+
+    memset(table, 0xff, sizeof(uint32_t) << COMPRESS_HASH_BITS);
+
+    for (size_t pos = 0; pos + COMPRESS_MIN_MATCH <= n; ) {
+        uint32_t seq;
+        memcpy(&seq, in + pos, sizeof(seq));
+        uint32_t hash = (seq * 2654435761U) >> (32 - COMPRESS_HASH_BITS);
+        uint32_t candidate = table[hash];
+        table[hash] = pos;
+
+        if (candidate == UINT32_MAX || memcmp(in + candidate, in + pos, COMPRESS_MIN_MATCH) != 0) {
+            pos++;
+            continue;
+        }
+
+        size_t match = COMPRESS_MIN_MATCH;
+        while (pos + match < n && in[candidate + match] == in[pos + match]) {
+            match++;
+        }
+
+        if (!write_sequence(out, o, cap, in + anchor, pos - anchor, pos - candidate, match)) {
+            return 0;
+        }
+
+        pos += match;
+        anchor = pos;
+    }
+
+    if (!write_sequence(out, o, cap, in + anchor, n - anchor, 0, 0)) {
+        return 0;
+    }
+
+    return o;
+}
+
+// Returns size of decompressed block or -1 if it's damaged or bigger than cap.
+static int lz_decompress(const uint8_t *in, size_t n, uint8_t *out, size_t cap) {
+    size_t i = 0;
+    size_t o = 0;
+
+    while (i < n) {
+        uint8_t token = in[i++];
+        size_t literals_len = token >> 4;
+
+        if (!read_run(in, n, i, literals_len) || literals_len > n - i || literals_len > cap - o) {
+            return -1;
+        }
+
+        memcpy(out + o, in + i, literals_len);
+        i += literals_len;
+        o += literals_len;
+
+        if (i == n) {
+            break;
+        }
+
+        if (n - i < 2) {
+            return -1;
+        }
+
+        size_t offset = (in[i] << 8) | in[i + 1];
+        size_t match = token & COMPRESS_RUN_MASK;
+        i += 2;
+
+        if (!read_run(in, n, i, match)) {
+            return -1;
+        }
+
+        match += COMPRESS_MIN_MATCH;
+
+        if (offset == 0 || offset > o || match > cap - o) {
+            return -1;
+        }
+
+        for (size_t k = 0; k < match; k++, o++) {
+            out[o] = out[o - offset];
+        }
+    }
+
+    return o;
+}
+
+size_t compress_events(compressor_t &comp, uint32_t game_id, const uint8_t *events, size_t len,
+                       uint8_t *out, size_t cap) {
+    if (len > COMPRESS_MAX_RAW || cap <= COMPRESSED_HEAD) {
+        return 0;
+    }
+
+    size_t transformed = transform(events, len, comp.transformed.data());
+    uint8_t *ptr = game_id_layout::encode(out, game_id);
+    compressed_head_layout::encode(ptr, COMPRESSED_MARK, transformed, calculate_crc32(events, len));
+
+    size_t block = lz_compress(comp.table, comp.transformed.data(), transformed,
+                               out + COMPRESSED_HEAD, cap - COMPRESSED_HEAD);
+
+    return block ? COMPRESSED_HEAD + block : 0;
+}
+
+int decompress_events(vector<uint8_t> &scratch, const uint8_t *buff, size_t size, uint8_t *out, size_t cap) {
+    uint64_t offset = 0;
+
+    if (size < COMPRESSED_HEAD || cap < game_id_layout::size) {
+        return -1;
+    }
+
+    auto [game_id] = game_id_layout::decode(buff, offset);
+    auto [mark, transformed, crc] = compressed_head_layout::decode(buff, offset);
+    (void) mark;
+
+    if (transformed > scratch.size() ||
+        lz_decompress(buff + offset, size - offset, scratch.data(), transformed) != static_cast<int>(transformed)) {
+        return -1;
+    }
+
+    const uint8_t *in = scratch.data();
+    delta_state_t state;
+    size_t o = game_id_layout::encode(out, game_id) - out;
+
+    for (uint64_t pos = 0; pos < transformed; ) {
+        if (transformed - pos < run_layout::size) {
+            return -1;
+        }
+
+        auto [len, cnt] = run_layout::decode(in, pos);
+        uint64_t event_size = event_len_layout::size + len + crc_layout::size;
+
+        if (len < event_head_layout::size || len * cnt > transformed - pos || o + event_size * cnt > cap) {
+            return -1;
+        }
+
+        for (size_t r = 0; r < cnt; r++) {
+            uint8_t *event = out + o;
+            uint8_t *data = event_len_layout::encode(event, len);
+
+            decode_row(state, in + pos + r, cnt, len, data);
+            crc_layout::encode(data + len, calculate_crc32(event, event_len_layout::size + len));
+            o += event_size;
+        }
+
+        pos += len * cnt;
+    }
+
+    if (calculate_crc32(out + game_id_layout::size, o - game_id_layout::size) != crc) {
+        return -1;
+    }
+
+    return o;
+}
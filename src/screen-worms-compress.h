@@ -0,0 +1,55 @@
+#ifndef SK_SCREEN_WORMS_COMPRESS_H
+#define SK_SCREEN_WORMS_COMPRESS_H
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "common.h"
+
+// Compressed catch-up datagram, sent only to clients which asked for it:
+//   game_id, COMPRESSED_MARK in place of the first event's len,
+//   transformed size, crc32 of the events and the LZ block.
+// Events are first transformed knowing their encoding (see transform in
+// screen-worms-compress.cpp): crc of every event is dropped (the receiver
+// computes it anew and checks crc of all events instead) and fields which
+// change little from event to event are stored as differences. The LZ block
+// (LZ4-like sequences of literals and matches) then squeezes the repetitions.
+enum constants_compress {
+    COMPRESSED_MARK = 0,
+    COMPRESSED_HEAD = 4 * DWORD,
+
+    // Events of one datagram, so offsets and sizes fit in 16 bits.
+    COMPRESS_MAX_RAW = 65535,
+    // All compressed datagrams of one catch-up.
+    COMPRESS_BUFFER = 1 << 20,
+    // Expected ratio, the first datagram of a catch-up tries that many bytes of events.
+    COMPRESS_GUESS = 8,
+    COMPRESS_HASH_BITS = 12,
+    COMPRESS_MIN_MATCH = 4,
+    COMPRESS_RUN_MASK = 15,
+};
+
+// Scratch memory of the compressor, kept between datagrams.
+struct compressor_t {
+    std::vector<uint8_t> transformed = std::vector<uint8_t>(COMPRESS_MAX_RAW);
+    uint32_t table[1 << COMPRESS_HASH_BITS];
+};
+
+// Tells whether datagram from the server is compressed.
+inline bool is_compressed(const uint8_t *buff, size_t size) {
+    uint64_t offset = game_id_layout::size;
+    return size >= COMPRESSED_HEAD && event_len_layout::decode(buff, offset)[0] == COMPRESSED_MARK;
+}
+
+// Compresses whole events lying in events[0, len) into datagram of given
+// game after it. Returns size of the datagram or 0 if it wouldn't fit in cap.
+size_t compress_events(compressor_t &comp, uint32_t game_id, const uint8_t *events, size_t len,
+                       uint8_t *out, size_t cap);
+
+// Restores uncompressed datagram (game_id and events with their crc)
+// in out. Returns its size or -1 if the datagram is damaged or too big.
+int decompress_events(std::vector<uint8_t> &scratch, const uint8_t *buff, size_t size,
+                      uint8_t *out, size_t cap);
+
+#endif
@@ -0,0 +1,156 @@
+#include "screen-worms-events.h"
+
+// Makes one message per planned datagram, pointing at its iovecs and address.
+static void prepare_messages(datagrams_t &out, sockaddr_in6 *addrs, size_t iovs_per_message) {
+    vector<pair<int, size_t>> &plan = out.plan;
+    vector<mmsghdr> &msgs = out.msgs;
+
+    msgs.resize(plan.size());
+    for (size_t i = 0; i < plan.size(); i++) {
+        mmsghdr &msg = msgs[i];
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_hdr.msg_name = &addrs[plan[i].first];
+        msg.msg_hdr.msg_namelen = sizeof(sockaddr_in6);
+        msg.msg_hdr.msg_iov = &out.iovs[plan[i].second];
+        msg.msg_hdr.msg_iovlen = iovs_per_message;
+    }
+}
+
+// Splits events from next_expected_event_no to the most recent one into datagrams,
+// fitting as many events in one datagram as its size allows. Events lie one after
+// another in the log, so every datagram is just game_id and one slice of the log.
+// Datagrams are built once per distinct datagram size and addressed to all given
+// addresses. Returns amount of messages prepared in out.msgs.
+size_t pack_events(datagrams_t &out, uint32_t game_id, event_log_t &events, uint32_t next_expected_event_no,
+                   sockaddr_in6 *addrs, uint32_t *datagram_sizes, int addr_cnt) {
+    vector<iovec> &iovs = out.iovs;
+    vector<pair<int, size_t>> &plan = out.plan;
+    vector<mmsghdr> &msgs = out.msgs;
+    vector<uint32_t> &sizes = out.sizes;
+
+    iovs.clear();
+    plan.clear();
+    msgs.clear();
+    sizes.clear();
+
+    if (next_expected_event_no >= events.size() || addr_cnt == 0) {
+        return 0;
+    }
+
+    uint8_t *encoded_game_id = out.encoded_game_id;
+    game_id_layout::encode(encoded_game_id, game_id);
+
+    for (int a = 0; a < addr_cnt; a++) {
+        if (find(sizes.begin(), sizes.end(), datagram_sizes[a]) == sizes.end()) {
+            sizes.push_back(datagram_sizes[a]);
+        }
+    }
+
+    for (uint32_t size : sizes) {
+        size_t first_iov = iovs.size();
+        size_t len = game_id_layout::size;
+
+        for (size_t i = next_expected_event_no; i < events.size(); i++) {
+            size_t event_size = events.event_size(i);
+
+            if (i == next_expected_event_no || len + event_size > size) {
+                iovs.push_back({encoded_game_id, game_id_layout::size});
+                iovs.push_back({const_cast<uint8_t*>(events.event(i)), 0});
+                len = game_id_layout::size;
+            }
+
+            iovs.back().iov_len += event_size;
+            len += event_size;
+        }
+
+        for (int b = 0; b < addr_cnt; b++) {
+            if (datagram_sizes[b] == size) {
+                for (size_t i = first_iov; i < iovs.size(); i += 2) {
+                    plan.emplace_back(b, i);
+                }
+            }
+        }
+    }
+
+    prepare_messages(out, addrs, 2);
+    return msgs.size();
+}
+
+// Compresses events from next_expected_event_no on into datagrams of up to
+// datagram_size bytes, one after another in out.compressed. Every datagram takes
+// as many whole events as fit after compression. How many bytes of events
+// that is gets guessed from the ratio of the previous datagram and halved
+// until it fits. A single event too big for a datagram goes alone, like in
+// pack_events. Stops when out.compressed is full, the client asks for the rest.
+size_t pack_compressed_events(datagrams_t &out, uint32_t game_id, event_log_t &events, uint32_t next_expected_event_no,
+                              sockaddr_in6 *addr, uint32_t datagram_size) {
+    vector<iovec> &iovs = out.iovs;
+    vector<uint8_t> &compressed = out.compressed;
+
+    iovs.clear();
+    out.plan.clear();
+    out.msgs.clear();
+    out.sizes.clear();
+    out.raw_bytes = 0;
+    out.compressed_bytes = 0;
+
+    if (compressed.size() < COMPRESS_BUFFER) {
+        compressed.resize(COMPRESS_BUFFER);
+    }
+
+    size_t budget = min<size_t>(datagram_size * COMPRESS_GUESS, COMPRESS_MAX_RAW);
+    size_t used = 0;
+
+    for (size_t i = next_expected_event_no; i < events.size() && used + datagram_size <= compressed.size(); ) {
+        size_t first = events.offsets[i];
+        size_t last = i + 1;
+
+        while (last < events.size() && events.offsets[last] + events.event_size(last) - first <= budget) {
+            last++;
+        }
+
+        size_t raw = events.offsets[last - 1] + events.event_size(last - 1) - first;
+        size_t cap = last == i + 1 ? min<size_t>(MAX_DATAGRAM, compressed.size() - used) : datagram_size;
+        size_t size = compress_events(out.compressor, game_id, events.event(i), raw, &compressed[used], cap);
+
+        if (size == 0) {
+            if (last == i + 1) {
+                break;
+            }
+
+            budget = max<size_t>(raw / 2, 1);
+            continue;
+        }
+
+        iovs.push_back({&compressed[used], size});
+        out.plan.emplace_back(0, iovs.size() - 1);
+        out.raw_bytes += raw;
+        out.compressed_bytes += size;
+
+        budget = min<size_t>(max<size_t>(raw * datagram_size / size, 1), COMPRESS_MAX_RAW);
+        used += size;
+        i = last;
+    }
+
+    prepare_messages(out, addr, 1);
+    return out.msgs.size();
+}
+
+int send_datagrams(int sock, datagrams_t &datagrams) {
+    vector<mmsghdr> &msgs = datagrams.msgs;
+    int syscalls = 0;
+
+    for (size_t sent = 0; sent < msgs.size(); ) {
+        unsigned int batch = min(msgs.size() - sent, static_cast<size_t>(UIO_MAXIOV));
+        int res = sendmmsg(sock, &msgs[sent], batch, 0);
+        syscalls++;
+
+        if (res <= 0) {
+            return -1;
+        }
+
+        sent += res;
+    }
+
+    return syscalls;
+}
@@ -0,0 +1,104 @@
+#ifndef SK_SCREEN_WORMS_EVENTS_H
+#define SK_SCREEN_WORMS_EVENTS_H
+
+#include <bits/stdc++.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+#include "common.h"
+#include "screen-worms-compress.h"
+
+using namespace std;
+
+// Encoded events of one game stored one after another in a single buffer.
+// Memory is kept between games, so appending usually doesn't allocate.
+struct event_log_t {
+    vector<uint8_t> data;
+    vector<size_t> offsets;
+
+    size_t size() const {
+        return offsets.size();
+    }
+
+    // Returns pointer to the beginning of i-th event.
+    const uint8_t *event(size_t i) const {
+        return &data[offsets[i]];
+    }
+
+    size_t event_size(size_t i) const {
+        return (i + 1 < offsets.size() ? offsets[i + 1] : data.size()) - offsets[i];
+    }
+
+    // Reserves len bytes for new event and returns pointer to them.
+    uint8_t *append(size_t len) {
+        offsets.push_back(data.size());
+        data.resize(data.size() + len);
+        return &data[offsets.back()];
+    }
+
+    void clear() {
+        data.clear();
+        offsets.clear();
+    }
+
+    // Makes room for given amount of bytes and events without touching
+    // the memory, so appending within it never reallocates.
+    void reserve_capacity(size_t bytes, size_t events) {
+        data.reserve(bytes);
+        offsets.reserve(events);
+    }
+
+    // Allocates memory for given amount of bytes and events and touches it.
+    void reserve(size_t bytes, size_t events) {
+        data.resize(max(data.size(), bytes));
+        data.resize(0);
+        offsets.resize(max(offsets.size(), events));
+        offsets.resize(0);
+    }
+};
+
+// Datagrams prepared for sendmmsg. Every message points at two iovecs:
+// encoded game_id and a slice of the event log, or (if compressed) at one
+// iovec with the whole datagram in compressed.
+struct datagrams_t {
+    uint8_t encoded_game_id[game_id_layout::size] {};
+    vector<iovec> iovs;
+    vector<pair<int, size_t>> plan;
+    vector<mmsghdr> msgs;
+    vector<uint32_t> sizes;
+
+    compressor_t compressor;
+    vector<uint8_t> compressed;
+    // Bytes of events in the last compressed datagrams and of the datagrams.
+    size_t raw_bytes = 0;
+    size_t compressed_bytes = 0;
+
+    // Makes room for given amount of datagrams, so packing up to that many
+    // doesn't allocate.
+    void reserve(size_t cnt) {
+        iovs.reserve(2 * cnt);
+        plan.reserve(cnt);
+        msgs.reserve(cnt);
+        sizes.reserve(MAX_PLAYERS + 1);
+        compressed.resize(COMPRESS_BUFFER);
+    }
+};
+
+// Splits events from next_expected_event_no to the most recent one into datagrams
+// for all given addresses, built once per distinct datagram size. Returns amount
+// of messages prepared in out.msgs.
+size_t pack_events(datagrams_t &out, uint32_t game_id, event_log_t &events, uint32_t next_expected_event_no,
+                   sockaddr_in6 *addrs, uint32_t *datagram_sizes, int addr_cnt);
+
+// Packs events from next_expected_event_no on into compressed datagrams for one
+// address. Returns amount of messages prepared in out.msgs.
+size_t pack_compressed_events(datagrams_t &out, uint32_t game_id, event_log_t &events, uint32_t next_expected_event_no,
+                              sockaddr_in6 *addr, uint32_t datagram_size);
+
+// Sends prepared datagrams with sendmmsg. Returns amount of system calls
+// made or -1 if sending failed.
+int send_datagrams(int sock, datagrams_t &datagrams);
+
+#endif
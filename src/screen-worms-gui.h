@@ -0,0 +1,146 @@
+#ifndef SK_SCREEN_WORMS_GUI_H
+#define SK_SCREEN_WORMS_GUI_H
+
+#include <cstdint>
+#include <cstring>
+#include <endian.h>
+#include <string>
+#include <vector>
+
+#include "common.h"
+
+// Binary gui protocol, the client's output with -g instead of text lines.
+// Stream of frames, every frame is its head and then len bytes:
+//   GUI_NEW_GAME: max_x, max_y, amount of players and for every player
+//       length of the name and the name. Later frames refer to players
+//       by their index in this table.
+//   GUI_EVENTS: gui_record_t records, len / sizeof(gui_record_t) of them,
+//       all PIXEL and PLAYER_ELIMINATED events of one datagram from server.
+// Numbers are Little Endian. Coordinates fit in 16 bits (the server's
+// board is at most MAX_WIDTH x MAX_HEIGHT), x and y of elimination are 0.
+enum constants_gui {
+    GUI_NEW_GAME = 1,
+    GUI_EVENTS = 2,
+
+    GUI_MAX_COORD = 65536,
+};
+
+struct gui_frame_head_t {
+    uint32_t len;
+    uint8_t type;
+} __attribute__((packed));
+
+struct gui_new_game_t {
+    uint32_t max_x;
+    uint32_t max_y;
+    uint8_t players;
+} __attribute__((packed));
+
+struct gui_record_t {
+    uint8_t type;
+    uint8_t player;
+    uint16_t x;
+    uint16_t y;
+} __attribute__((packed));
+
+// Appends frame of new game with given players to out.
+inline void encode_gui_new_game(std::vector<uint8_t> &out, uint32_t max_x, uint32_t max_y,
+                                const std::string *names, uint32_t players) {
+    size_t start = out.size();
+    gui_frame_head_t head {0, GUI_NEW_GAME};
+    gui_new_game_t game {htole32(max_x), htole32(max_y), static_cast<uint8_t>(players)};
+
+    out.resize(start + sizeof(head));
+    out.insert(out.end(), reinterpret_cast<uint8_t*>(&game), reinterpret_cast<uint8_t*>(&game + 1));
+
+    for (uint32_t i = 0; i < players; i++) {
+        out.push_back(names[i].size());
+        out.insert(out.end(), names[i].begin(), names[i].end());
+    }
+
+    head.len = htole32(out.size() - start - sizeof(head));
+    memcpy(&out[start], &head, sizeof(head));
+}
+
+// Reads frames from a stream, which may be split anywhere.
+struct gui_decoder_t {
+    std::vector<uint8_t> pending;
+    uint32_t max_x = 0;
+    uint32_t max_y = 0;
+    std::vector<std::string> names;
+
+    // Takes next bytes of the stream and passes every whole frame to
+    // on_new_game() (once names, max_x and max_y are updated) or to
+    // on_record(record) for each of its records, in host order.
+    // Returns false if the stream is damaged.
+    template<typename NEW_GAME, typename RECORD>
+    bool feed(const uint8_t *data, size_t len, NEW_GAME on_new_game, RECORD on_record) {
+        pending.insert(pending.end(), data, data + len);
+        size_t pos = 0;
+
+        while (pending.size() - pos >= sizeof(gui_frame_head_t)) {
+            gui_frame_head_t head;
+            memcpy(&head, &pending[pos], sizeof(head));
+            uint32_t frame_len = le32toh(head.len);
+
+            if (pending.size() - pos - sizeof(head) < frame_len) {
+                break;
+            }
+
+            const uint8_t *frame = &pending[pos + sizeof(head)];
+            pos += sizeof(head) + frame_len;
+
+            if (head.type == GUI_NEW_GAME) {
+                if (!decode_new_game(frame, frame_len)) {
+                    return false;
+                }
+                on_new_game();
+            }
+            else if (head.type == GUI_EVENTS && frame_len % sizeof(gui_record_t) == 0) {
+                for (size_t i = 0; i < frame_len; i += sizeof(gui_record_t)) {
+                    gui_record_t record;
+                    memcpy(&record, frame + i, sizeof(record));
+                    record.x = le16toh(record.x);
+                    record.y = le16toh(record.y);
+
+                    if (record.player >= names.size()) {
+                        return false;
+                    }
+                    on_record(record);
+                }
+            }
+            else {
+                return false;
+            }
+        }
+
+        pending.erase(pending.begin(), pending.begin() + pos);
+        return true;
+    }
+
+    bool decode_new_game(const uint8_t *frame, uint32_t len) {
+        gui_new_game_t game;
+
+        if (len < sizeof(game)) {
+            return false;
+        }
+
+        memcpy(&game, frame, sizeof(game));
+        max_x = le32toh(game.max_x);
+        max_y = le32toh(game.max_y);
+        names.clear();
+
+        for (size_t pos = sizeof(game); names.size() < game.players; ) {
+            if (pos >= len || pos + 1 + frame[pos] > len) {
+                return false;
+            }
+
+            names.emplace_back(reinterpret_cast<const char*>(frame + pos + 1), frame[pos]);
+            pos += 1 + frame[pos];
+        }
+
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,238 @@
+#include "screen-worms-guidecode.h"
+
+// Reference decoder of the binary gui protocol (see screen-worms-gui.h).
+// With -r it acts as a gui: waits for the client on given port and prints
+// what it gets as lines of the text protocol, saving the stream to -f if
+// given. Otherwise it decodes the stream saved in -f; with -l it measures
+// instead how long decoding it takes, against parsing the same events
+// rendered as text lines the way a text gui has to.
+
+// Returns current time in microseconds.
+uint64_t get_time() {
+    timeval tv {};
+    gettimeofday(&tv, nullptr);
+    return tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+void update_options(memory_guidecode_t &mem, int argc, char *argv[]) {
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:f:l:")) != -1) {
+        if (opt == '?') {
+            cout<<"unknown option"<<endl;
+            exit(1);
+        }
+
+        if (opt == 'f') {
+            mem.stream_path = optarg;
+            continue;
+        }
+
+        char *ptr;
+        uint32_t val = strtol(optarg, &ptr, 10);
+
+        if (*ptr != 0) {
+            cout<<"incorrect option value"<<endl;
+            exit(1);
+        }
+
+        if (opt == 'r') {
+            mem.port = val;
+        }
+        else if (opt == 'l') {
+            mem.loops = val;
+        }
+    }
+
+    if (mem.port == 0 && mem.stream_path.empty()) {
+        cout<<"missing stream"<<endl;
+        exit(1);
+    }
+}
+
+// Renders frames as text lines, the same the client writes in text mode.
+string render_text(gui_decoder_t &decoder, const uint8_t *data, size_t len) {
+    string text;
+
+    auto on_new_game = [&]() {
+        text += "NEW_GAME " + to_string(decoder.max_x) + " " + to_string(decoder.max_y);
+
+        for (string &name : decoder.names) {
+            text += " " + name;
+        }
+        text += "\n";
+    };
+    auto on_record = [&](gui_record_t &record) {
+        if (record.type == PIXEL_TYPE) {
+            text += "PIXEL " + to_string(record.x) + " " + to_string(record.y) + " " +
+                    decoder.names[record.player] + "\n";
+        }
+        else {
+            text += "PLAYER_ELIMINATED " + decoder.names[record.player] + "\n";
+        }
+    };
+
+    if (!decoder.feed(data, len, on_new_game, on_record)) {
+        cout<<"incorrect stream"<<endl;
+        exit(1);
+    }
+
+    return text;
+}
+
+// Waits for the client and prints its stream until it disconnects.
+void serve(memory_guidecode_t &mem) {
+    int listener = socket(AF_INET6, SOCK_STREAM, 0);
+    int reuse = 1;
+    int v6OnlyEnabled = 0;
+
+    sockaddr_in6 addr {};
+    addr.sin6_family = AF_INET6;
+    addr.sin6_addr = in6addr_any;
+    addr.sin6_port = htons(mem.port);
+
+    if (listener < 0 || setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0 ||
+        setsockopt(listener, IPPROTO_IPV6, IPV6_V6ONLY, &v6OnlyEnabled, sizeof(v6OnlyEnabled)) != 0 ||
+        bind(listener, (sockaddr*) &addr, sizeof(addr)) < 0 || listen(listener, 1) < 0) {
+        cout<<"socket"<<endl;
+        exit(1);
+    }
+
+    int sock = accept(listener, nullptr, nullptr);
+    FILE *stream = mem.stream_path.empty() ? nullptr : fopen(mem.stream_path.c_str(), "wb");
+    static uint8_t buff[GUIDECODE_READ];
+    ssize_t len;
+
+    if (sock < 0 || (!mem.stream_path.empty() && stream == nullptr)) {
+        cout<<"accept"<<endl;
+        exit(1);
+    }
+
+    while ((len = read(sock, buff, sizeof(buff))) > 0) {
+        if (stream != nullptr) {
+            fwrite(buff, 1, len, stream);
+        }
+
+        cout<<render_text(mem.decoder, buff, len)<<flush;
+    }
+
+    if (stream != nullptr) {
+        fclose(stream);
+    }
+}
+
+vector<uint8_t> load_stream(const string &path) {
+    ifstream in(path, ios::binary);
+
+    if (!in) {
+        cout<<"incorrect stream file"<<endl;
+        exit(1);
+    }
+
+    return vector<uint8_t>(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+}
+
+// Parses text lines the way a gui reading the text protocol must: splits
+// them into words, converts numbers and finds players by name. Returns
+// amount of events.
+uint64_t parse_text(const string &text, uint64_t &checksum) {
+    unordered_map<string, uint32_t> players;
+    uint64_t events = 0;
+    istringstream lines(text);
+    string line;
+
+    while (getline(lines, line)) {
+        istringstream words(line);
+        string word;
+        words>>word;
+        events++;
+
+        if (word == "NEW_GAME") {
+            uint32_t max_x, max_y;
+            words>>max_x>>max_y;
+            players.clear();
+
+            while (words>>word) {
+                players.emplace(word, players.size());
+            }
+            checksum += max_x + max_y;
+        }
+        else if (word == "PIXEL") {
+            uint32_t x, y;
+            words>>x>>y>>word;
+            checksum += x + y + players[word];
+        }
+        else {
+            words>>word;
+            checksum += players[word];
+        }
+    }
+
+    return events;
+}
+
+// Decodes the stream (and parses it rendered as text) given amount of times.
+void benchmark(memory_guidecode_t &mem) {
+    vector<uint8_t> stream = load_stream(mem.stream_path);
+    gui_decoder_t text_decoder;
+    string text = render_text(text_decoder, stream.data(), stream.size());
+
+    uint64_t events = 0;
+    uint64_t binary_checksum = 0;
+    uint64_t start = get_time();
+
+    for (uint32_t loop = 0; loop < mem.loops; loop++) {
+        gui_decoder_t decoder;
+        auto on_new_game = [&]() {
+            binary_checksum += decoder.max_x + decoder.max_y;
+            events++;
+        };
+        auto on_record = [&](gui_record_t &record) {
+            binary_checksum += record.x + record.y + record.player;
+            events++;
+        };
+
+        decoder.feed(stream.data(), stream.size(), on_new_game, on_record);
+    }
+
+    uint64_t binary_duration = max<uint64_t>(get_time() - start, 1);
+    uint64_t text_checksum = 0;
+    uint64_t text_events = 0;
+    start = get_time();
+
+    for (uint32_t loop = 0; loop < mem.loops; loop++) {
+        text_events += parse_text(text, text_checksum);
+    }
+
+    uint64_t text_duration = max<uint64_t>(get_time() - start, 1);
+
+    if (events != text_events || binary_checksum != text_checksum) {
+        cout<<"decoded events differ"<<endl;
+        exit(1);
+    }
+
+    events = max<uint64_t>(events, 1);
+    cout<<"events="<<events / mem.loops<<" loops="<<mem.loops
+        <<" binary_bytes="<<stream.size()<<" text_bytes="<<text.size()
+        <<fixed<<setprecision(2)
+        <<" binary_bytes_per_event="<<double(stream.size()) * mem.loops / events
+        <<" text_bytes_per_event="<<double(text.size()) * mem.loops / events
+        <<" binary_ns_per_event="<<double(binary_duration) * 1000 / events
+        <<" text_ns_per_event="<<double(text_duration) * 1000 / events<<endl;
+}
+
+int main(int argc, char *argv[]) {
+    memory_guidecode_t mem {};
+    update_options(mem, argc, argv);
+
+    if (mem.port != 0) {
+        serve(mem);
+    }
+    else if (mem.loops == 0) {
+        vector<uint8_t> stream = load_stream(mem.stream_path);
+        cout<<render_text(mem.decoder, stream.data(), stream.size());
+    }
+    else {
+        benchmark(mem);
+    }
+}
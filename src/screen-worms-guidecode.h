@@ -0,0 +1,28 @@
+#ifndef SK_SCREEN_WORMS_GUIDECODE_H
+#define SK_SCREEN_WORMS_GUIDECODE_H
+
+#include <bits/stdc++.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "common.h"
+#include "screen-worms-gui.h"
+
+using namespace std;
+
+enum constants_guidecode {
+    GUIDECODE_READ = 1 << 16,
+};
+
+struct memory_guidecode_t {
+    uint16_t port = 0;
+    string stream_path;
+    uint32_t loops = 0;
+
+    gui_decoder_t decoder;
+};
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef SK_SCREEN_WORMS_LATENCY_H
+#define SK_SCREEN_WORMS_LATENCY_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <sys/socket.h>
+
+// Latency of answering client's message, from the kernel's receive timestamp
+// (SO_TIMESTAMPNS) through the start of handling it to the reply. Replies
+// carrying events the client missed are catch-up. The others are live: the
+// client is up to date and is answered by the broadcast carrying the event
+// it asked for, when that goes out.
+enum constants_latency {
+    LATENCY_LIVE = 0,
+    LATENCY_CATCH_UP,
+    LATENCY_KINDS,
+
+    // In the socket (and receive queue), in the server's loop, both.
+    LATENCY_SOCKET = 0,
+    LATENCY_LOOP,
+    LATENCY_TOTAL,
+    LATENCY_STAGES,
+
+    // Every power of two of nanoseconds is split into 2^LATENCY_SUB_BITS buckets.
+    LATENCY_SUB_BITS = 2,
+    LATENCY_BUCKETS = 44 << LATENCY_SUB_BITS,
+};
+
+// Returns current time of the clock used by receive timestamps, in nanoseconds.
+inline uint64_t realtime_ns() {
+    timespec ts {};
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Returns the kernel's receive time (in nanoseconds) of the received message
+// or 0 if it doesn't carry one.
+inline uint64_t receive_timestamp(msghdr &msg) {
+    for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+            const timespec *ts = reinterpret_cast<const timespec*>(CMSG_DATA(cmsg));
+            return ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+        }
+    }
+
+    return 0;
+}
+
+// Times of one message, 0 if not measured.
+struct latency_sample_t {
+    uint64_t received = 0;
+    uint64_t started = 0;
+};
+
+// Histogram with buckets growing exponentially, filled from any thread.
+struct latency_histogram_t {
+    std::atomic<uint64_t> buckets[LATENCY_BUCKETS] {};
+    std::atomic<uint64_t> count {0};
+    std::atomic<uint64_t> sum {0};
+    std::atomic<uint64_t> max {0};
+
+    static size_t bucket(uint64_t ns) {
+        if (ns < (1 << LATENCY_SUB_BITS)) {
+            return ns;
+        }
+
+        int exp = 63 - __builtin_clzll(ns);
+        size_t sub = (ns >> (exp - LATENCY_SUB_BITS)) & ((1 << LATENCY_SUB_BITS) - 1);
+        size_t i = ((exp - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS) + sub;
+
+        return i < LATENCY_BUCKETS ? i : LATENCY_BUCKETS - 1;
+    }
+
+    // Returns the smallest value falling into given bucket.
+    static uint64_t lower_bound(size_t i) {
+        if (i < (1 << LATENCY_SUB_BITS)) {
+            return i;
+        }
+
+        int exp = (i >> LATENCY_SUB_BITS) + LATENCY_SUB_BITS - 1;
+        uint64_t sub = i & ((1 << LATENCY_SUB_BITS) - 1);
+
+        return ((1ULL << LATENCY_SUB_BITS) + sub) << (exp - LATENCY_SUB_BITS);
+    }
+
+    void add(uint64_t ns) {
+        buckets[bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(ns, std::memory_order_relaxed);
+
+        uint64_t old = max.load(std::memory_order_relaxed);
+        while (old < ns && !max.compare_exchange_weak(old, ns, std::memory_order_relaxed)) {
+        }
+    }
+};
+
+struct latency_t {
+    latency_histogram_t histograms[LATENCY_KINDS][LATENCY_STAGES];
+
+    // Notes latency of message answered (with reply of given kind) at replied.
+    void record(int kind, latency_sample_t sample, uint64_t replied) {
+        if (sample.received == 0) {
+            return;
+        }
+
+        // Timestamps come from the same clock, but it may be stepped meanwhile.
+        uint64_t started = std::max(sample.started, sample.received);
+        replied = std::max(replied, started);
+
+        histograms[kind][LATENCY_SOCKET].add(started - sample.received);
+        histograms[kind][LATENCY_LOOP].add(replied - started);
+        histograms[kind][LATENCY_TOTAL].add(replied - sample.received);
+    }
+};
+
+#endif
@@ -0,0 +1,217 @@
+#include "screen-worms-loadgen.h"
+
+// Returns current time in microseconds.
+uint64_t get_time() {
+    timeval tv {};
+    gettimeofday(&tv, nullptr);
+    return tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// Parses options. First argument from command line is taken for server's address.
+void update_options(memory_loadgen_t &mem, int argc, char *argv[]) {
+    int opt;
+
+    if (argc < 2) {
+        cout<<"missing server address"<<endl;
+        exit(1);
+    }
+
+    mem.server_ip = argv[1];
+
+    while ((opt = getopt(argc - 1, &argv[1], "p:n:d:s:")) != -1) {
+        if (opt == '?') {
+            cout<<"unknown option"<<endl;
+            exit(1);
+        }
+
+        char *ptr;
+        uint32_t val = strtol(optarg, &ptr, 10);
+
+        if (*ptr != 0) {
+            cout<<"incorrect option value"<<endl;
+            exit(1);
+        }
+
+        if (opt == 'p') {
+            mem.server_port = optarg;
+        }
+        else if (opt == 'n') {
+            mem.clients_cnt = max<uint32_t>(val, LOADGEN_PLAYERS);
+        }
+        else if (opt == 'd') {
+            mem.duration = val;
+        }
+        else if (opt == 's') {
+            mem.server_pid = val;
+        }
+    }
+}
+
+// Creates non blocking UDP sockets connected to the server, one per client.
+void create_clients(memory_loadgen_t &mem) {
+    addrinfo addr_hints {};
+    addrinfo *addr_result;
+
+    addr_hints.ai_family = AF_UNSPEC;
+    addr_hints.ai_socktype = SOCK_DGRAM;
+    addr_hints.ai_protocol = IPPROTO_UDP;
+
+    if (getaddrinfo(mem.server_ip.c_str(), mem.server_port.c_str(), &addr_hints, &addr_result) != 0) {
+        cout<<"addr info"<<endl;
+        exit(1);
+    }
+
+    mem.epoll_fd = epoll_create1(0);
+    mem.clients.resize(mem.clients_cnt);
+    uint64_t now = get_time();
+
+    for (uint32_t i = 0; i < mem.clients_cnt; i++) {
+        fake_client_t &client = mem.clients[i];
+        client.sock = socket(addr_result->ai_family, addr_result->ai_socktype | SOCK_NONBLOCK,
+                             addr_result->ai_protocol);
+
+        if (client.sock < 0 || connect(client.sock, addr_result->ai_addr, addr_result->ai_addrlen) < 0) {
+            cout<<"socket"<<endl;
+            exit(1);
+        }
+
+        client.session_id = now + i;
+        if (i < LOADGEN_PLAYERS) {
+            client.name = "bot" + to_string(i);
+        }
+
+        epoll_event event {};
+        event.events = EPOLLIN;
+        event.data.u32 = i;
+        epoll_ctl(mem.epoll_fd, EPOLL_CTL_ADD, client.sock, &event);
+    }
+
+    freeaddrinfo(addr_result);
+}
+
+// Sends heartbeat of one client, as screen-worms-client does.
+void send_heartbeat(memory_loadgen_t &mem, fake_client_t &client) {
+    client_mess_t mess {};
+    mess.session_id = htobe64(client.session_id);
+    mess.turn_direction = client.name.empty() ? STRAIGHT : RIGHT;
+    mess.next_expected_event_no = htobe32(client.next_event_no);
+    memcpy(mess.player_name, client.name.c_str(), client.name.size());
+
+    if (send(client.sock, &mess, MESS_BASIC_LEN + client.name.size(), 0) > 0) {
+        mem.sent++;
+    }
+}
+
+// Reads all datagrams waiting for the client and moves its next_event_no
+// past the last event with consecutive number.
+void read_datagrams(memory_loadgen_t &mem, fake_client_t &client) {
+    static uint8_t buff[MAX_DATAGRAM];
+
+    while (true) {
+        int size = recv(client.sock, buff, sizeof(buff), 0);
+
+        if (size <= 0) {
+            return;
+        }
+
+        mem.received++;
+        mem.received_bytes += size;
+
+        if (!client.answered) {
+            client.answered = true;
+            mem.answered_clients++;
+        }
+
+        uint64_t offset = 0;
+        auto [game_id] = game_id_layout::decode(buff, offset);
+
+        if (game_id != client.game_id) {
+            client.game_id = game_id;
+            client.next_event_no = 0;
+        }
+
+        while (offset + event_len_layout::size + event_head_layout::size <= static_cast<uint64_t>(size)) {
+            uint64_t event_offset = offset;
+            auto [len] = event_len_layout::decode(buff, offset);
+            auto [event_no, event_type] = event_head_layout::decode(buff, offset);
+
+            if (event_no == client.next_event_no) {
+                client.next_event_no++;
+            }
+
+            offset = event_offset + event_len_layout::size + len + crc_layout::size;
+            (void) event_type;
+        }
+    }
+}
+
+// Returns used cpu time of the process in clock ticks (0 if unknown).
+uint64_t get_cpu_time(pid_t pid) {
+    ifstream stat("/proc/" + to_string(pid) + "/stat");
+    string field;
+    uint64_t utime = 0;
+    uint64_t stime = 0;
+
+    for (int i = 1; i <= 15 && stat >> field; i++) {
+        if (i == 14) {
+            utime = stoull(field);
+        }
+        else if (i == 15) {
+            stime = stoull(field);
+        }
+    }
+
+    return utime + stime;
+}
+
+// Sends heartbeats of all clients evenly spread over the message span
+// and reads answers, until the duration passes.
+void run(memory_loadgen_t &mem) {
+    static epoll_event events[EPOLL_BATCH];
+
+    uint64_t start = get_time();
+    uint64_t end = start + mem.duration * 1000000ULL;
+    uint64_t cpu_start = mem.server_pid ? get_cpu_time(mem.server_pid) : 0;
+    size_t next_client = 0;
+    uint64_t next_send = start;
+    uint64_t send_gap = max<uint64_t>(1, LOADGEN_MESSAGE_SPAN / mem.clients_cnt);
+    uint64_t now;
+
+    while ((now = get_time()) < end) {
+        while (next_send <= now) {
+            send_heartbeat(mem, mem.clients[next_client]);
+            next_client = (next_client + 1) % mem.clients_cnt;
+            next_send += send_gap;
+        }
+
+        int ready = epoll_wait(mem.epoll_fd, events, EPOLL_BATCH, EPOLL_WAIT);
+
+        for (int i = 0; i < ready; i++) {
+            read_datagrams(mem, mem.clients[events[i].data.u32]);
+        }
+    }
+
+    double seconds = (get_time() - start) / 1e6;
+    cout<<"clients="<<mem.clients_cnt
+        <<" answered_clients="<<mem.answered_clients
+        <<" seconds="<<seconds
+        <<" sent_per_sec="<<mem.sent / seconds
+        <<" received_per_sec="<<mem.received / seconds
+        <<" received_bytes_per_sec="<<mem.received_bytes / seconds;
+
+    if (mem.server_pid) {
+        double cpu = (get_cpu_time(mem.server_pid) - cpu_start) / static_cast<double>(sysconf(_SC_CLK_TCK));
+        cout<<" server_cpu_percent="<<100 * cpu / seconds;
+    }
+
+    cout<<endl;
+}
+
+int main(int argc, char *argv[]) {
+    memory_loadgen_t mem {};
+
+    update_options(mem, argc, argv);
+    create_clients(mem);
+
+    run(mem);
+}
@@ -0,0 +1,60 @@
+#ifndef SK_SCREEN_WORMS_LOADGEN_H
+#define SK_SCREEN_WORMS_LOADGEN_H
+
+#include <bits/stdc++.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <endian.h>
+
+#include "common.h"
+
+using namespace std;
+
+enum constants_loadgen {
+    MESS_BASIC_LEN = 13,
+    LOADGEN_MESSAGE_SPAN = 30000,
+    LOADGEN_PLAYERS = 2,
+    EPOLL_BATCH = 256,
+    EPOLL_WAIT = 1,
+};
+
+// One simulated client. First LOADGEN_PLAYERS clients play, so that games
+// keep running; the rest are spectators. The server takes at most
+// MAX_PLAYERS + 1 clients and ignores messages of the others, so above that
+// the extra clients only load its receive path; answered tells which
+// clients were served. With thousands of clients backends are thus compared
+// on receiving, their sending is exercised by the served clients only.
+struct fake_client_t {
+    int sock = -1;
+    uint64_t session_id = 0;
+    string name;
+
+    uint32_t game_id = 0;
+    uint32_t next_event_no = 0;
+    bool answered = false;
+};
+
+struct memory_loadgen_t {
+    string server_ip;
+    string server_port = "2021";
+    uint32_t clients_cnt = 1000;
+    uint32_t duration = 5;
+    pid_t server_pid = 0;
+
+    vector<fake_client_t> clients;
+    int epoll_fd = -1;
+
+    uint64_t sent = 0;
+    uint64_t received = 0;
+    uint64_t received_bytes = 0;
+    uint32_t answered_clients = 0;
+};
+
+#endif
@@ -0,0 +1,87 @@
+#include "screen-worms-local.h"
+
+void start_shared_memory(memory_server_t &mem) {
+    if (mem.SHM_NAME.empty()) {
+        return;
+    }
+
+    if (!map_shm(mem.shm, mem.SHM_NAME.c_str(), true)) {
+        cout<<"shared memory"<<endl;
+        exit(1);
+    }
+}
+
+// Events of a new game start right after the ones already written, readers
+// learn where from game_first. Head counters are moved after each event,
+// so a reader can tell whether the event it copied was overwritten meanwhile.
+void publish_shared_events(memory_server_t &mem) {
+    if (mem.shm.header == nullptr) {
+        return;
+    }
+
+    shm_header_t &header = *mem.shm.header;
+    uint64_t head = header.head_events.load(memory_order_relaxed);
+    uint64_t pos = header.head_bytes.load(memory_order_relaxed);
+
+    if (mem.shm_game_id != mem.game_id || mem.shm_published > mem.events.size()) {
+        mem.shm_game_id = mem.game_id;
+        mem.shm_published = 0;
+        header.game_first.store(head, memory_order_release);
+    }
+
+    for (; mem.shm_published < mem.events.size(); mem.shm_published++) {
+        uint32_t size = mem.events.event_size(mem.shm_published);
+
+        if (pos % SHM_RING_BYTES + size > SHM_RING_BYTES) {
+            pos += SHM_RING_BYTES - pos % SHM_RING_BYTES;
+        }
+
+        memcpy(mem.shm.bytes + pos % SHM_RING_BYTES, mem.events.event(mem.shm_published), size);
+        mem.shm.entries[head % SHM_RING_EVENTS] = {pos, mem.game_id, size};
+
+        pos += size;
+        head++;
+        header.head_bytes.store(pos, memory_order_release);
+        header.head_events.store(head, memory_order_release);
+    }
+}
+
+// Local client is seen as address 100::<mailbox> (from the discard prefix),
+// which is never sent to.
+static void local_addr(sockaddr_in6 &addr, int mailbox) {
+    addr = {};
+    addr.sin6_family = AF_INET6;
+    addr.sin6_addr.s6_addr[0] = 1;
+    addr.sin6_addr.s6_addr[15] = mailbox;
+}
+
+// Message is taken if it's new and wasn't being written while copied.
+void read_mailboxes(memory_server_t &mem) {
+    if (mem.shm.header == nullptr) {
+        return;
+    }
+
+    for (int i = 0; i < SHM_MAILBOXES; i++) {
+        shm_mailbox_t &mailbox = mem.shm.header->mailboxes[i];
+        uint32_t seq = mailbox.seq.load(memory_order_acquire);
+
+        if (seq == mem.mailbox_seq[i] || seq % 2 == 1) {
+            continue;
+        }
+
+        client_input_t input {};
+        memcpy(&input.mess, &mailbox.mess, sizeof(client_mess_t));
+        atomic_thread_fence(memory_order_acquire);
+
+        if (mailbox.seq.load(memory_order_relaxed) != seq) {
+            continue;
+        }
+
+        mem.mailbox_seq[i] = seq;
+        input.mess.session_id = be64toh(input.mess.session_id);
+        input.mess.next_expected_event_no = be32toh(input.mess.next_expected_event_no);
+        local_addr(input.addr, i);
+
+        handle_client_input(mem, input, true);
+    }
+}
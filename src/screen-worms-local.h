@@ -0,0 +1,15 @@
+#ifndef SK_SCREEN_WORMS_LOCAL_H
+#define SK_SCREEN_WORMS_LOCAL_H
+
+#include "screen-worms-server.h"
+
+// Creates shared memory for local clients if its name was given.
+void start_shared_memory(memory_server_t &mem);
+
+// Writes events that local clients haven't got yet into the ring.
+void publish_shared_events(memory_server_t &mem);
+
+// Handles new messages from mailboxes of local clients.
+void read_mailboxes(memory_server_t &mem);
+
+#endif
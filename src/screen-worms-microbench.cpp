@@ -0,0 +1,318 @@
+#include "screen-worms-server.h"
+#include <time.h>
+
+// Microbenchmarks of the server's hot primitives. Every case prints one line
+// of key=value pairs, so results of two builds can be compared by a script:
+//   bench=<case> <parameters> iterations=<n> ns_per_op=<time>
+
+enum constants_microbench {
+    BENCH_RAND_MULT = 48271,
+    BENCH_RAND_MOD = 2147483647,
+    BENCH_LOG_EVENTS = 1000,
+};
+
+struct options_microbench_t {
+    uint64_t min_time_ns = 200000000;
+    string filter;
+};
+
+// Keeps results alive, so the compiler can't drop the measured work.
+volatile uint64_t sink;
+
+// Returns monotonic time in nanoseconds.
+uint64_t get_time_ns() {
+    timespec ts {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void update_options(options_microbench_t &opts, int argc, char *argv[]) {
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:f:")) != -1) {
+        if (opt == '?') {
+            cout<<"unknown option"<<endl;
+            exit(1);
+        }
+
+        if (opt == 'f') {
+            opts.filter = optarg;
+            continue;
+        }
+
+        char *ptr;
+        uint32_t val = strtol(optarg, &ptr, 10);
+
+        if (*ptr != 0) {
+            cout<<"incorrect option value"<<endl;
+            exit(1);
+        }
+
+        if (opt == 't') {
+            opts.min_time_ns = val * 1000000ull;
+        }
+    }
+}
+
+// Runs the case with growing amount of iterations until it takes at least
+// the minimal time and prints the result. run(n) does n operations and
+// returns the time (in nanoseconds) spent on the measured part.
+template<typename F>
+void measure(options_microbench_t &opts, const string &name, const string &params, F run) {
+    if (name.find(opts.filter) == string::npos) {
+        return;
+    }
+
+    run(1);
+
+    uint64_t iterations = 1;
+    uint64_t elapsed = run(iterations);
+
+    while (elapsed < opts.min_time_ns) {
+        uint64_t factor = elapsed == 0 ? 100 : min<uint64_t>(100, opts.min_time_ns * 12 / 10 / elapsed + 1);
+        iterations *= max<uint64_t>(factor, 2);
+        elapsed = run(iterations);
+    }
+
+    cout<<"bench="<<name<<" "<<params<<" iterations="<<iterations
+        <<" ns_per_op="<<static_cast<double>(elapsed) / iterations<<endl;
+}
+
+// Returns ip6 address with given port, ip4 mapped one if v4 is set.
+sockaddr_in6 make_addr(bool v4, uint16_t port) {
+    sockaddr_in6 addr {};
+    addr.sin6_family = AF_INET6;
+    addr.sin6_port = htons(port);
+    inet_pton(AF_INET6, v4 ? "::ffff:192.168.1.17" : "2001:db8:85a3::8a2e:370:7334", &addr.sin6_addr);
+    return addr;
+}
+
+// Fills the event log with a new game event followed by pixel events.
+void fill_log(memory_server_t &mem, size_t cnt) {
+    mem.events.clear();
+    uint8_t *event = mem.events.append(new_game_event::size);
+    calculate_crc(event, new_game_layout::encode(new_game_event::encode_head(event, new_game_event::len, 0),
+                                                 mem.WIDTH, mem.HEIGHT) - event);
+
+    for (size_t i = 1; i < cnt; i++) {
+        add_pixel_event(mem, i % MAX_PLAYERS, i % mem.WIDTH, i / mem.WIDTH);
+    }
+}
+
+// Places worms (all of them bots, so they steer away from walls) on empty board.
+void setup_worms(memory_server_t &mem, int worms, uint64_t &r) {
+    auto next = [&r]() {
+        r = r * BENCH_RAND_MULT % BENCH_RAND_MOD;
+        return static_cast<uint32_t>(r);
+    };
+
+    mem.worms.clear();
+    mem.events.clear();
+    mem.last_event = 0;
+    clean_board(mem);
+    mem.worms_alive = worms;
+
+    for (int i = 0; i < worms; i++) {
+        double pos_x = next() % mem.WIDTH + 0.5;
+        double pos_y = next() % mem.HEIGHT + 0.5;
+        int x = floor(pos_x);
+        int y = floor(pos_y);
+        bool eliminated = mem.board.get(x, y);
+
+        if (eliminated) {
+            mem.worms_alive--;
+        }
+        mem.board.set(x, y);
+
+        mem.worms.push_back(pos_x, pos_y, next() % 360, STRAIGHT, eliminated, true);
+    }
+}
+
+void bench_codec(options_microbench_t &opts) {
+    uint8_t buff[pixel_event::size] {};
+
+    measure(opts, "encode_pixel", "bytes=" + to_string(pixel_event::size), [&](uint64_t n) {
+        uint64_t start = get_time_ns();
+        for (uint64_t i = 0; i < n; i++) {
+            pixel_event::encode(buff, i, i & 0xff, i & 0xffff, i >> 16);
+            sink = buff[5];
+        }
+        return get_time_ns() - start;
+    });
+
+    measure(opts, "decode_pixel", "bytes=" + to_string(pixel_event::size), [&](uint64_t n) {
+        uint64_t start = get_time_ns();
+        for (uint64_t i = 0; i < n; i++) {
+            buff[8] = i;
+            uint64_t offset = event_head_layout::size + event_len_layout::size;
+            sink = pixel_layout::decode(buff, offset)[1];
+        }
+        return get_time_ns() - start;
+    });
+
+    for (size_t len : {static_cast<size_t>(pixel_event::len), static_cast<size_t>(MAX_UDP),
+                       static_cast<size_t>(MAX_DATAGRAM)}) {
+        vector<uint8_t> data(len + crc_layout::size);
+
+        measure(opts, "calculate_crc", "bytes=" + to_string(len), [&](uint64_t n) {
+            uint64_t start = get_time_ns();
+            for (uint64_t i = 0; i < n; i++) {
+                data[0] = i;
+                calculate_crc(&data[0], len);
+                sink = data[len];
+            }
+            return get_time_ns() - start;
+        });
+    }
+}
+
+void bench_players(options_microbench_t &opts, memory_server_t &mem) {
+    for (bool v4 : {true, false}) {
+        sockaddr_in6 addr = make_addr(v4, 2021);
+
+        measure(opts, "get_player_id", string("family=") + (v4 ? "ip4" : "ip6"), [&](uint64_t n) {
+            uint64_t start = get_time_ns();
+            for (uint64_t i = 0; i < n; i++) {
+                addr.sin6_port = i;
+                sink = get_player_id(addr).size();
+            }
+            return get_time_ns() - start;
+        });
+    }
+
+    for (int players : {1, 10, static_cast<int>(MAX_PLAYERS)}) {
+        mem.players.clear();
+
+        for (int i = 0; i < players; i++) {
+            sockaddr_in6 addr = make_addr(true, 3000 + i);
+            player_t player {};
+            player.name = "player" + to_string(i);
+            player.addr = addr;
+            mem.players[get_player_id(addr)] = player;
+        }
+
+        client_mess_t mess {};
+        sockaddr_in6 known_addr = make_addr(true, 3000 + players / 2);
+        string known = get_player_id(known_addr);
+        memcpy(mess.player_name, mem.players[known].name.c_str(), mem.players[known].name.size());
+
+        measure(opts, "is_ignored", "players=" + to_string(players) + " client=known", [&](uint64_t n) {
+            uint64_t start = get_time_ns();
+            for (uint64_t i = 0; i < n; i++) {
+                sink = is_ignored(mem, mess, known);
+            }
+            return get_time_ns() - start;
+        });
+
+        sockaddr_in6 new_addr = make_addr(false, 4000);
+        string unknown = get_player_id(new_addr);
+
+        measure(opts, "is_ignored", "players=" + to_string(players) + " client=new", [&](uint64_t n) {
+            uint64_t start = get_time_ns();
+            for (uint64_t i = 0; i < n; i++) {
+                sink = is_ignored(mem, mess, unknown);
+            }
+            return get_time_ns() - start;
+        });
+    }
+
+    mem.players.clear();
+}
+
+// Packing only: datagrams are prepared the way send_events_to_client and the
+// broadcast do it, but never handed to a socket.
+void bench_packing(options_microbench_t &opts, memory_server_t &mem) {
+    datagrams_t datagrams;
+    sockaddr_in6 addrs[MAX_PLAYERS + 1];
+    uint32_t datagram_sizes[MAX_PLAYERS + 1];
+
+    mem.WIDTH = MAX_WIDTH;
+    mem.HEIGHT = MAX_HEIGHT;
+    fill_log(mem, BENCH_LOG_EVENTS);
+
+    for (int clients : {1, MAX_PLAYERS + 1}) {
+        for (uint32_t size : {static_cast<uint32_t>(MAX_UDP), 9000u}) {
+            for (int i = 0; i < clients; i++) {
+                addrs[i] = make_addr(true, 3000 + i);
+                datagram_sizes[i] = size;
+            }
+
+            for (uint32_t from : {0u, static_cast<uint32_t>(BENCH_LOG_EVENTS - 10)}) {
+                string params = "clients=" + to_string(clients) + " datagram=" + to_string(size) +
+                                " events=" + to_string(BENCH_LOG_EVENTS - from);
+
+                measure(opts, "pack_events", params, [&](uint64_t n) {
+                    uint64_t start = get_time_ns();
+                    for (uint64_t i = 0; i < n; i++) {
+                        sink = pack_events(datagrams, i, mem.events, from, addrs, datagram_sizes, clients);
+                    }
+                    return get_time_ns() - start;
+                });
+            }
+        }
+    }
+
+    mem.events.clear();
+}
+
+void bench_board(options_microbench_t &opts, memory_server_t &mem) {
+    for (auto size : {make_pair(100, 100), make_pair(640, 480), make_pair(2000, 2000),
+                      make_pair(static_cast<int>(MAX_WIDTH), static_cast<int>(MAX_HEIGHT))}) {
+        mem.WIDTH = size.first;
+        mem.HEIGHT = size.second;
+        string board = "board=" + to_string(mem.WIDTH) + "x" + to_string(mem.HEIGHT);
+        clean_board(mem);
+
+        // Only painted tiles are cleared, so the board gets a diagonal line
+        // (outside of the measured time) before every clean.
+        measure(opts, "clean_board", board + " painted=diagonal", [&](uint64_t n) {
+            uint64_t elapsed = 0;
+
+            for (uint64_t i = 0; i < n; i++) {
+                for (int d = 0; d < min(mem.WIDTH, mem.HEIGHT); d++) {
+                    mem.board.set(d, d);
+                }
+
+                uint64_t start = get_time_ns();
+                clean_board(mem);
+                elapsed += get_time_ns() - start;
+            }
+            return elapsed;
+        });
+
+        for (int worms : {2, static_cast<int>(MAX_PLAYERS), static_cast<int>(MAX_WORMS)}) {
+            string params = board + " worms=" + to_string(worms);
+            uint64_t r = 1;
+
+            // Games that end are set up again, outside of the measured time.
+            measure(opts, "make_moves", params, [&](uint64_t n) {
+                uint64_t elapsed = 0;
+                setup_worms(mem, worms, r);
+
+                for (uint64_t i = 0; i < n; i++) {
+                    if (mem.worms_alive <= 1) {
+                        setup_worms(mem, worms, r);
+                    }
+
+                    uint64_t start = get_time_ns();
+                    sink = make_moves(mem);
+                    elapsed += get_time_ns() - start;
+                }
+                return elapsed;
+            });
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    options_microbench_t opts {};
+    update_options(opts, argc, argv);
+
+    auto mem = make_unique<memory_server_t>();
+    mem->SIMD_LEVEL = detect_simd_level();
+
+    bench_codec(opts);
+    bench_players(opts, *mem);
+    bench_packing(opts, *mem);
+    bench_board(opts, *mem);
+}
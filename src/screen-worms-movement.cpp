@@ -0,0 +1,214 @@
+#include "screen-worms-movement.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SK_X86
+#endif
+
+namespace {
+
+// Values of cos and sin for every whole direction, computed with
+// the same expression as the original per worm calls.
+struct direction_table_t {
+    double cos_tab[360];
+    double sin_tab[360];
+
+    direction_table_t() {
+        for (int i = 0; i < 360; i++) {
+            cos_tab[i] = cos(i * M_PI / 180);
+            sin_tab[i] = sin(i * M_PI / 180);
+        }
+    }
+};
+
+const direction_table_t directions;
+
+// Moves worms from begin to end one at a time.
+void move_scalar(worms_t &worms, size_t begin, size_t end, int turning_speed) {
+    for (size_t i = begin; i < end; i++) {
+        if (worms.eliminated[i]) {
+            continue;
+        }
+
+        int32_t direction = worms.direction[i];
+
+        if (worms.turn_direction[i] == RIGHT) {
+            direction += turning_speed;
+        }
+        else if (worms.turn_direction[i] == LEFT) {
+            direction += 360 - turning_speed;
+        }
+        direction %= 360;
+
+        worms.direction[i] = direction;
+        worms.pos_x[i] += direction_cos(direction);
+        worms.pos_y[i] += direction_sin(direction);
+        worms.new_x[i] = floor(worms.pos_x[i]);
+        worms.new_y[i] = floor(worms.pos_y[i]);
+    }
+}
+
+#ifdef SK_X86
+
+// Checks whether four worms starting from i are all eliminated.
+// Most worms of a mass arena die early, so such blocks are skipped.
+bool four_eliminated(worms_t &worms, size_t i) {
+    uint32_t flags;
+    memcpy(&flags, &worms.eliminated[i], sizeof(flags));
+    return flags == 0x01010101;
+}
+
+// Turns four worms starting from i. Directions stay in [0, 360)
+// as turning speed is in [0, 360]. Always inlined, so the avx2 kernel
+// gets it in VEX encoding and doesn't pay for SSE/AVX transitions.
+__attribute__((target("sse4.1"), always_inline))
+inline __m128i turn_four(worms_t &worms, size_t i, int turning_speed) {
+    const __m128i right = _mm_set1_epi32(RIGHT);
+    const __m128i left = _mm_set1_epi32(LEFT);
+    const __m128i right_delta = _mm_set1_epi32(turning_speed);
+    const __m128i left_delta = _mm_set1_epi32(360 - turning_speed);
+    const __m128i full = _mm_set1_epi32(360);
+    const __m128i last = _mm_set1_epi32(359);
+
+    __m128i direction = _mm_loadu_si128(reinterpret_cast<__m128i*>(&worms.direction[i]));
+    __m128i turn = _mm_loadu_si128(reinterpret_cast<__m128i*>(&worms.turn_direction[i]));
+    __m128i delta = _mm_or_si128(_mm_and_si128(_mm_cmpeq_epi32(turn, right), right_delta),
+                                 _mm_and_si128(_mm_cmpeq_epi32(turn, left), left_delta));
+
+    direction = _mm_add_epi32(direction, delta);
+    direction = _mm_sub_epi32(direction, _mm_and_si128(_mm_cmpgt_epi32(direction, last), full));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&worms.direction[i]), direction);
+
+    return direction;
+}
+
+__attribute__((target("sse4.1")))
+size_t move_sse41(worms_t &worms, size_t end, int turning_speed) {
+    size_t i = 0;
+    alignas(16) int32_t direction[4];
+
+    for (; i + 4 <= end; i += 4) {
+        if (four_eliminated(worms, i)) {
+            continue;
+        }
+
+        _mm_store_si128(reinterpret_cast<__m128i*>(direction), turn_four(worms, i, turning_speed));
+
+        for (size_t half = 0; half < 4; half += 2) {
+            __m128d cos_val = _mm_set_pd(directions.cos_tab[direction[half + 1]], directions.cos_tab[direction[half]]);
+            __m128d sin_val = _mm_set_pd(directions.sin_tab[direction[half + 1]], directions.sin_tab[direction[half]]);
+            __m128d x = _mm_add_pd(_mm_loadu_pd(&worms.pos_x[i + half]), cos_val);
+            __m128d y = _mm_add_pd(_mm_loadu_pd(&worms.pos_y[i + half]), sin_val);
+
+            _mm_storeu_pd(&worms.pos_x[i + half], x);
+            _mm_storeu_pd(&worms.pos_y[i + half], y);
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(&worms.new_x[i + half]), _mm_cvttpd_epi32(_mm_floor_pd(x)));
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(&worms.new_y[i + half]), _mm_cvttpd_epi32(_mm_floor_pd(y)));
+        }
+    }
+
+    return i;
+}
+
+__attribute__((target("avx2")))
+size_t move_avx2(worms_t &worms, size_t end, int turning_speed) {
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d all = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+    size_t i = 0;
+
+    for (; i + 4 <= end; i += 4) {
+        if (four_eliminated(worms, i)) {
+            continue;
+        }
+
+        __m128i direction = turn_four(worms, i, turning_speed);
+        __m256d cos_val = _mm256_mask_i32gather_pd(zero, directions.cos_tab, direction, all, sizeof(double));
+        __m256d sin_val = _mm256_mask_i32gather_pd(zero, directions.sin_tab, direction, all, sizeof(double));
+        __m256d x = _mm256_add_pd(_mm256_loadu_pd(&worms.pos_x[i]), cos_val);
+        __m256d y = _mm256_add_pd(_mm256_loadu_pd(&worms.pos_y[i]), sin_val);
+
+        _mm256_storeu_pd(&worms.pos_x[i], x);
+        _mm256_storeu_pd(&worms.pos_y[i], y);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(&worms.new_x[i]), _mm256_cvttpd_epi32(_mm256_floor_pd(x)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(&worms.new_y[i]), _mm256_cvttpd_epi32(_mm256_floor_pd(y)));
+    }
+
+    return i;
+}
+
+#endif
+
+}
+
+void worms_t::clear() {
+    pos_x.clear();
+    pos_y.clear();
+    direction.clear();
+    turn_direction.clear();
+    cell_x.clear();
+    cell_y.clear();
+    new_x.clear();
+    new_y.clear();
+    eliminated.clear();
+    bot.clear();
+}
+
+void worms_t::push_back(double x, double y, int32_t dir, int32_t turn, bool eliminated_worm, bool bot_worm) {
+    pos_x.push_back(x);
+    pos_y.push_back(y);
+    direction.push_back(dir);
+    turn_direction.push_back(turn);
+    cell_x.push_back(floor(x));
+    cell_y.push_back(floor(y));
+    new_x.push_back(floor(x));
+    new_y.push_back(floor(y));
+    eliminated.push_back(eliminated_worm);
+    bot.push_back(bot_worm);
+}
+
+int detect_simd_level() {
+#ifdef SK_X86
+    if (__builtin_cpu_supports("avx2")) {
+        return SIMD_AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return SIMD_SSE41;
+    }
+#endif
+    return SIMD_SCALAR;
+}
+
+double direction_cos(int32_t direction) {
+    if (0 <= direction && direction < 360) {
+        return directions.cos_tab[direction];
+    }
+
+    return cos(direction * M_PI / 180);
+}
+
+double direction_sin(int32_t direction) {
+    if (0 <= direction && direction < 360) {
+        return directions.sin_tab[direction];
+    }
+
+    return sin(direction * M_PI / 180);
+}
+
+void move_worms(worms_t &worms, int turning_speed, int level) {
+    size_t done = 0;
+
+#ifdef SK_X86
+    if (0 <= turning_speed && turning_speed <= 360) {
+        if (level >= SIMD_AVX2) {
+            done = move_avx2(worms, worms.size(), turning_speed);
+        }
+        else if (level >= SIMD_SSE41) {
+            done = move_sse41(worms, worms.size(), turning_speed);
+        }
+    }
+#else
+    (void) level;
+#endif
+
+    move_scalar(worms, done, worms.size(), turning_speed);
+}
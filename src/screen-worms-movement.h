@@ -0,0 +1,51 @@
+#ifndef SK_SCREEN_WORMS_MOVEMENT_H
+#define SK_SCREEN_WORMS_MOVEMENT_H
+
+#include <bits/stdc++.h>
+
+#include "common.h"
+
+using namespace std;
+
+enum simd_level {
+    SIMD_SCALAR = 0,
+    SIMD_SSE41,
+    SIMD_AVX2,
+};
+
+// Worms stored as structure of arrays, so that many of them can be moved
+// with vector instructions. cell_x and cell_y hold the pixel the worm is on,
+// new_x and new_y the pixel it has reached in the current turn.
+struct worms_t {
+    vector<double> pos_x;
+    vector<double> pos_y;
+    vector<int32_t> direction;
+    vector<int32_t> turn_direction;
+    vector<int32_t> cell_x;
+    vector<int32_t> cell_y;
+    vector<int32_t> new_x;
+    vector<int32_t> new_y;
+    vector<uint8_t> eliminated;
+    vector<uint8_t> bot;
+
+    size_t size() const {
+        return pos_x.size();
+    }
+
+    void clear();
+    void push_back(double x, double y, int32_t dir, int32_t turn, bool eliminated_worm, bool bot_worm);
+};
+
+// Returns the best vector instruction set supported by the processor.
+int detect_simd_level();
+
+// Returns move along given axis for worm heading in given direction (in degrees).
+double direction_cos(int32_t direction);
+double direction_sin(int32_t direction);
+
+// Turns all worms, moves them one step forward and sets new_x and new_y.
+// Results don't depend on the instruction set used, so every level gives
+// the same game.
+void move_worms(worms_t &worms, int turning_speed, int level);
+
+#endif
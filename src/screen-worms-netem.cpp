@@ -0,0 +1,445 @@
+#include "screen-worms-netem.h"
+
+// Impairment profiles selectable with -P. Single values may be changed
+// with their own options afterwards.
+const profile_t profiles[] = {
+    {"clean", 0, 0, 0, 0, 0},
+    {"lan", 0, 1, 1, 0, 0},
+    {"wan", 1, 40, 10, 0, 1},
+    {"lossy", 10, 20, 5, 2, 5},
+    {"hostile", 25, 80, 40, 10, 20},
+};
+
+// Returns current time in microseconds.
+uint64_t get_time() {
+    timeval tv {};
+    gettimeofday(&tv, nullptr);
+    return tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// Parses options. First argument from command line is taken for server's address.
+void update_options(memory_netem_t &mem, int argc, char *argv[]) {
+    int opt;
+
+    if (argc < 2) {
+        cout<<"missing server address"<<endl;
+        exit(1);
+    }
+
+    mem.server_ip = argv[1];
+    mem.profile = profiles[0];
+
+    while ((opt = getopt(argc - 1, &argv[1], "p:l:P:x:D:j:u:r:t:s:")) != -1) {
+        if (opt == '?') {
+            cout<<"unknown option"<<endl;
+            exit(1);
+        }
+
+        if (opt == 'P') {
+            bool found = false;
+
+            for (const profile_t &profile : profiles) {
+                if (profile.name == optarg) {
+                    mem.profile = profile;
+                    found = true;
+                }
+            }
+
+            if (!found) {
+                cout<<"unknown profile"<<endl;
+                exit(1);
+            }
+            continue;
+        }
+
+        char *ptr;
+        uint32_t val = strtol(optarg, &ptr, 10);
+
+        if (*ptr != 0) {
+            cout<<"incorrect option value"<<endl;
+            exit(1);
+        }
+
+        if (opt == 'p') {
+            mem.server_port = optarg;
+        }
+        else if (opt == 'l') {
+            mem.listen_port = val;
+        }
+        else if (opt == 'x') {
+            mem.profile.loss = min<uint32_t>(val, 100);
+        }
+        else if (opt == 'D') {
+            mem.profile.delay = val;
+        }
+        else if (opt == 'j') {
+            mem.profile.jitter = val;
+        }
+        else if (opt == 'u') {
+            mem.profile.duplicate = min<uint32_t>(val, 100);
+        }
+        else if (opt == 'r') {
+            mem.profile.reorder = min<uint32_t>(val, 100);
+        }
+        else if (opt == 't') {
+            mem.duration = val;
+        }
+        else if (opt == 's') {
+            mem.seed = val;
+        }
+    }
+
+    mem.rng.seed(mem.seed);
+}
+
+// Creates ip6 socket (accepting also ip4 clients) on which the proxy
+// pretends to be the server, and resolves the real server's address.
+void create_sockets(memory_netem_t &mem) {
+    addrinfo addr_hints {};
+    addr_hints.ai_family = AF_UNSPEC;
+    addr_hints.ai_socktype = SOCK_DGRAM;
+    addr_hints.ai_protocol = IPPROTO_UDP;
+
+    if (getaddrinfo(mem.server_ip.c_str(), mem.server_port.c_str(), &addr_hints, &mem.server_addr) != 0) {
+        cout<<"addr info"<<endl;
+        exit(1);
+    }
+
+    mem.sock = socket(AF_INET6, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    int v6OnlyEnabled = 0;
+
+    if (mem.sock < 0 ||
+        setsockopt(mem.sock, IPPROTO_IPV6, IPV6_V6ONLY, &v6OnlyEnabled, sizeof(v6OnlyEnabled)) != 0) {
+        cout<<"socket"<<endl;
+        exit(1);
+    }
+
+    sockaddr_in6 local_addr {};
+    local_addr.sin6_family = AF_INET6;
+    local_addr.sin6_addr = in6addr_any;
+    local_addr.sin6_port = htons(mem.listen_port);
+
+    if (bind(mem.sock, (sockaddr*) &local_addr, sizeof(local_addr)) < 0) {
+        cout<<"bind"<<endl;
+        exit(1);
+    }
+
+    mem.epoll_fd = epoll_create1(0);
+    epoll_event event {};
+    event.events = EPOLLIN;
+    event.data.u32 = 0;
+    epoll_ctl(mem.epoll_fd, EPOLL_CTL_ADD, mem.sock, &event);
+}
+
+// Returns index of the client with given address, adds it if it's new.
+size_t find_client(memory_netem_t &mem, sockaddr_in6 &addr) {
+    for (size_t i = 0; i < mem.clients.size(); i++) {
+        proxied_client_t &client = mem.clients[i];
+
+        if (client.addr.sin6_port == addr.sin6_port &&
+            memcmp(&client.addr.sin6_addr, &addr.sin6_addr, sizeof(addr.sin6_addr)) == 0) {
+            return i;
+        }
+    }
+
+    proxied_client_t client {};
+    client.addr = addr;
+    client.upstream = socket(mem.server_addr->ai_family, mem.server_addr->ai_socktype | SOCK_NONBLOCK,
+                             mem.server_addr->ai_protocol);
+
+    if (client.upstream < 0 || connect(client.upstream, mem.server_addr->ai_addr, mem.server_addr->ai_addrlen) < 0) {
+        cout<<"socket"<<endl;
+        exit(1);
+    }
+
+    epoll_event event {};
+    event.events = EPOLLIN;
+    event.data.u32 = mem.clients.size() + 1;
+    epoll_ctl(mem.epoll_fd, EPOLL_CTL_ADD, client.upstream, &event);
+
+    mem.clients.push_back(client);
+    return mem.clients.size() - 1;
+}
+
+// Returns first send times of events of given game, forgets the oldest game
+// if too many are kept.
+vector<uint64_t> &game_events(memory_netem_t &mem, uint32_t game_id) {
+    if (mem.first_sent.find(game_id) == mem.first_sent.end()) {
+        mem.games.push_back(game_id);
+
+        if (mem.games.size() > NETEM_KEPT_GAMES) {
+            mem.first_sent.erase(mem.games.front());
+            mem.games.pop_front();
+        }
+    }
+
+    return mem.first_sent[game_id];
+}
+
+// Walks through events of datagram sent by the server. Notes when each event
+// was sent for the first time and counts bytes of events that this client
+// has already been sent, which is the overhead of catching up.
+void inspect_from_server(memory_netem_t &mem, proxied_client_t &client, uint8_t *buff, size_t size, uint64_t now) {
+    mem.server_bytes += size;
+
+    if (size < game_id_layout::size) {
+        return;
+    }
+
+    uint64_t offset = 0;
+    auto [game_id] = game_id_layout::decode(buff, offset);
+    vector<uint64_t> &first_sent = game_events(mem, game_id);
+
+    if (client.sent_game_id != game_id) {
+        client.sent_game_id = game_id;
+        client.sent_events.clear();
+    }
+
+    while (offset + event_len_layout::size + event_head_layout::size <= size) {
+        uint64_t event_offset = offset;
+        auto [len] = event_len_layout::decode(buff, offset);
+        auto [event_no, event_type] = event_head_layout::decode(buff, offset);
+        uint64_t event_size = event_len_layout::size + len + crc_layout::size;
+        (void) event_type;
+
+        if (event_no >= first_sent.size()) {
+            first_sent.resize(event_no + 1, 0);
+        }
+        if (first_sent[event_no] == 0) {
+            first_sent[event_no] = now;
+        }
+
+        if (event_no >= client.sent_events.size()) {
+            client.sent_events.resize(event_no + 1, false);
+        }
+        if (client.sent_events[event_no]) {
+            mem.retransmit_bytes += event_size;
+        }
+        else {
+            client.sent_events[event_no] = true;
+            mem.unique_bytes += event_size;
+        }
+
+        offset = event_offset + event_size;
+    }
+}
+
+// Follows screen-worms-client reading datagram delivered to it: events are
+// taken strictly in order and the rest of datagram is dropped at the first
+// unexpected one. Records latency of every event the client takes.
+void inspect_delivered(memory_netem_t &mem, proxied_client_t &client, uint8_t *buff, size_t size, uint64_t now) {
+    if (size < game_id_layout::size + event_len_layout::size + event_head_layout::size) {
+        return;
+    }
+
+    uint64_t offset = 0;
+    auto [game_id] = game_id_layout::decode(buff, offset);
+
+    if (buff[game_id_layout::size + event_len_layout::size + DWORD] == NEW_GAME_TYPE && game_id != client.game_id) {
+        client.game_id = game_id;
+        client.next_event_no = 0;
+    }
+
+    if (game_id != client.game_id || mem.first_sent.find(game_id) == mem.first_sent.end()) {
+        return;
+    }
+
+    vector<uint64_t> &first_sent = mem.first_sent[game_id];
+
+    while (offset + event_len_layout::size + event_head_layout::size <= size) {
+        uint64_t event_offset = offset;
+        auto [len] = event_len_layout::decode(buff, offset);
+        auto [event_no, event_type] = event_head_layout::decode(buff, offset);
+        (void) event_type;
+
+        if (event_no != client.next_event_no) {
+            return;
+        }
+
+        client.next_event_no++;
+
+        if (event_no < first_sent.size() && first_sent[event_no] != 0) {
+            mem.interval_latencies.push_back(now - first_sent[event_no]);
+        }
+
+        offset = event_offset + event_len_layout::size + len + crc_layout::size;
+    }
+}
+
+// Passes datagram to its receiver.
+void deliver(memory_netem_t &mem, bool to_client, size_t client_num, vector<uint8_t> &data, uint64_t now) {
+    proxied_client_t &client = mem.clients[client_num];
+    mem.forwarded++;
+
+    if (to_client) {
+        inspect_delivered(mem, client, &data[0], data.size(), now);
+        sendto(mem.sock, &data[0], data.size(), 0, (sockaddr*) &client.addr, sizeof(client.addr));
+    }
+    else {
+        send(client.upstream, &data[0], data.size(), 0);
+    }
+}
+
+// Returns true with probability of percent.
+bool chance(memory_netem_t &mem, uint32_t percent) {
+    return percent > 0 && mem.rng() % 100 < percent;
+}
+
+// Applies the profile to one datagram: drops it, or schedules its delivery
+// (maybe twice) after the delay with jitter. Reordered datagrams are held
+// back longer, so the ones sent after them overtake them.
+void impair(memory_netem_t &mem, bool to_client, size_t client_num, uint8_t *buff, size_t size, uint64_t now) {
+    profile_t &profile = mem.profile;
+
+    if (chance(mem, profile.loss)) {
+        mem.dropped++;
+        return;
+    }
+
+    int copies = 1;
+    if (chance(mem, profile.duplicate)) {
+        mem.duplicated++;
+        copies++;
+    }
+
+    for (int i = 0; i < copies; i++) {
+        int64_t delay = profile.delay * 1000;
+
+        if (profile.jitter > 0) {
+            delay += static_cast<int64_t>(mem.rng() % (2 * profile.jitter * 1000 + 1)) - profile.jitter * 1000;
+        }
+        if (chance(mem, profile.reorder)) {
+            mem.reordered++;
+            delay += (profile.delay + 2 * profile.jitter) * 1000 + NETEM_REORDER_HOLD;
+        }
+
+        vector<uint8_t> data(buff, buff + size);
+
+        if (delay <= 0 && mem.delayed.empty()) {
+            deliver(mem, to_client, client_num, data, now);
+            continue;
+        }
+
+        delayed_datagram_t datagram {};
+        datagram.due = now + max<int64_t>(delay, 0);
+        datagram.seq = mem.next_seq++;
+        datagram.to_client = to_client;
+        datagram.client = client_num;
+        datagram.data = std::move(data);
+        mem.delayed.push(std::move(datagram));
+    }
+}
+
+// Reads all datagrams from the socket of given epoll entry.
+void read_datagrams(memory_netem_t &mem, uint32_t source) {
+    static uint8_t buff[MAX_DATAGRAM];
+
+    while (true) {
+        sockaddr_in6 addr {};
+        socklen_t addr_len = sizeof(addr);
+        int size;
+
+        if (source == 0) {
+            size = recvfrom(mem.sock, buff, sizeof(buff), 0, (sockaddr*) &addr, &addr_len);
+        }
+        else {
+            size = recv(mem.clients[source - 1].upstream, buff, sizeof(buff), 0);
+        }
+
+        if (size < 0) {
+            return;
+        }
+
+        uint64_t now = get_time();
+
+        if (source == 0) {
+            impair(mem, false, find_client(mem, addr), buff, size, now);
+        }
+        else {
+            inspect_from_server(mem, mem.clients[source - 1], buff, size, now);
+            impair(mem, true, source - 1, buff, size, now);
+        }
+    }
+}
+
+// Delivers all held datagrams whose time has come.
+void deliver_due(memory_netem_t &mem, uint64_t now) {
+    while (!mem.delayed.empty() && mem.delayed.top().due <= now) {
+        delayed_datagram_t datagram = mem.delayed.top();
+        mem.delayed.pop();
+        deliver(mem, datagram.to_client, datagram.client, datagram.data, now);
+    }
+}
+
+// Returns the given percentile of sorted values.
+uint32_t percentile(vector<uint32_t> &sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+
+    return sorted[min<size_t>(sorted.size() - 1, sorted.size() * p)];
+}
+
+// Prints delivery latencies (in microseconds) and catch-up overhead.
+void report(memory_netem_t &mem, const string &scope, vector<uint32_t> &latencies) {
+    sort(latencies.begin(), latencies.end());
+    double overhead = mem.unique_bytes ? 100.0 * mem.retransmit_bytes / mem.unique_bytes : 0;
+
+    cout<<"scope="<<scope<<" profile="<<mem.profile.name<<" clients="<<mem.clients.size()
+        <<" events="<<latencies.size()
+        <<" latency_p50_us="<<percentile(latencies, 0.5)
+        <<" latency_p90_us="<<percentile(latencies, 0.9)
+        <<" latency_p99_us="<<percentile(latencies, 0.99)
+        <<" latency_max_us="<<(latencies.empty() ? 0 : latencies.back())
+        <<" forwarded="<<mem.forwarded<<" dropped="<<mem.dropped
+        <<" duplicated="<<mem.duplicated<<" reordered="<<mem.reordered
+        <<" server_bytes="<<mem.server_bytes<<" retransmit_bytes="<<mem.retransmit_bytes
+        <<" overhead_percent="<<overhead<<endl;
+}
+
+// Forwards datagrams until the duration passes (forever if it's 0).
+// Prints latencies of the last interval every second and of the whole run at the end.
+void run(memory_netem_t &mem) {
+    static epoll_event events[NETEM_EPOLL_BATCH];
+
+    uint64_t start = get_time();
+    uint64_t end = mem.duration ? start + mem.duration * 1000000ULL : UINT64_MAX;
+    uint64_t next_report = start + NETEM_REPORT_SPAN;
+    uint64_t now;
+
+    while ((now = get_time()) < end) {
+        uint64_t deadline = min(next_report, end);
+        if (!mem.delayed.empty()) {
+            deadline = min(deadline, mem.delayed.top().due);
+        }
+
+        int wait = deadline > now ? (deadline - now + 999) / 1000 : 0;
+        int ready = epoll_wait(mem.epoll_fd, events, NETEM_EPOLL_BATCH, wait);
+
+        for (int i = 0; i < ready; i++) {
+            read_datagrams(mem, events[i].data.u32);
+        }
+
+        now = get_time();
+        deliver_due(mem, now);
+
+        if (now >= next_report) {
+            mem.latencies.insert(mem.latencies.end(), mem.interval_latencies.begin(), mem.interval_latencies.end());
+            report(mem, "interval", mem.interval_latencies);
+            mem.interval_latencies.clear();
+            next_report += NETEM_REPORT_SPAN;
+        }
+    }
+
+    mem.latencies.insert(mem.latencies.end(), mem.interval_latencies.begin(), mem.interval_latencies.end());
+    report(mem, "total", mem.latencies);
+}
+
+int main(int argc, char *argv[]) {
+    memory_netem_t mem {};
+
+    update_options(mem, argc, argv);
+    create_sockets(mem);
+
+    run(mem);
+}
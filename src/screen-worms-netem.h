@@ -0,0 +1,97 @@
+#ifndef SK_SCREEN_WORMS_NETEM_H
+#define SK_SCREEN_WORMS_NETEM_H
+
+#include <bits/stdc++.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/time.h>
+
+#include "common.h"
+
+using namespace std;
+
+enum constants_netem {
+    NETEM_EPOLL_BATCH = 64,
+    NETEM_REPORT_SPAN = 1000000,
+    NETEM_REORDER_HOLD = 5000,
+    NETEM_KEPT_GAMES = 8,
+};
+
+// Impairment applied to every datagram, in both directions.
+// Probabilities are in percents, times in milliseconds.
+struct profile_t {
+    string name;
+    uint32_t loss = 0;
+    uint32_t delay = 0;
+    uint32_t jitter = 0;
+    uint32_t duplicate = 0;
+    uint32_t reorder = 0;
+};
+
+// Client seen on the listening socket. Every client gets its own socket
+// towards the server, so the server sees them as separate clients.
+// The client's in-order parsing is followed here to know when it
+// could use each event.
+struct proxied_client_t {
+    sockaddr_in6 addr {};
+    int upstream = -1;
+
+    uint32_t game_id = 0;
+    uint32_t next_event_no = 0;
+
+    uint32_t sent_game_id = 0;
+    vector<bool> sent_events;
+};
+
+// Datagram held back by the proxy until its delivery time.
+struct delayed_datagram_t {
+    uint64_t due = 0;
+    uint64_t seq = 0;
+    bool to_client = false;
+    size_t client = 0;
+    vector<uint8_t> data;
+
+    bool operator>(const delayed_datagram_t &other) const {
+        return due != other.due ? due > other.due : seq > other.seq;
+    }
+};
+
+struct memory_netem_t {
+    string server_ip;
+    string server_port = "2021";
+    uint16_t listen_port = 2022;
+    uint32_t duration = 0;
+    uint32_t seed = 1;
+    profile_t profile;
+
+    addrinfo *server_addr = nullptr;
+    int sock = -1;
+    int epoll_fd = -1;
+    mt19937 rng;
+
+    vector<proxied_client_t> clients;
+    priority_queue<delayed_datagram_t, vector<delayed_datagram_t>, greater<delayed_datagram_t>> delayed;
+    uint64_t next_seq = 0;
+
+    // Time when the server sent each event for the first time, per game.
+    unordered_map<uint32_t, vector<uint64_t>> first_sent;
+    deque<uint32_t> games;
+
+    uint64_t forwarded = 0;
+    uint64_t dropped = 0;
+    uint64_t duplicated = 0;
+    uint64_t reordered = 0;
+    uint64_t server_bytes = 0;
+    uint64_t unique_bytes = 0;
+    uint64_t retransmit_bytes = 0;
+
+    vector<uint32_t> interval_latencies;
+    vector<uint32_t> latencies;
+};
+
+#endif
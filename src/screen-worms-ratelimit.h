@@ -0,0 +1,110 @@
+#ifndef SK_SCREEN_WORMS_RATELIMIT_H
+#define SK_SCREEN_WORMS_RATELIMIT_H
+
+#include <bits/stdc++.h>
+#include <netinet/in.h>
+#include <time.h>
+
+using namespace std;
+
+enum constants_ratelimit {
+    ADDRESS_BUCKET_BITS = 16,
+    SUBNET_BUCKET_BITS = 12,
+    RATE_BURST_MS = 200,
+    TOKEN_SCALE = 1000000,
+
+    SUBNET4_BITS = 24,
+    SUBNET6_BYTES = 8,
+
+    RATE_PASSED = 0,
+    RATE_ADDRESS_SHED,
+    RATE_SUBNET_SHED,
+};
+
+// Returns monotonic time in microseconds.
+inline uint64_t monotonic_time() {
+    timespec ts {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+// Token bucket filled with rate units per second, holding RATE_BURST_MS
+// worth of them. Tokens are counted in millionths of unit. Taking is
+// allowed while any token is left, so a bucket may go into debt by one
+// big take (like a long catch-up) and must refill before the next one.
+struct token_bucket_t {
+    int64_t tokens = 0;
+    uint64_t last = 0;
+
+    bool take(uint64_t rate, uint64_t cost, uint64_t now) {
+        int64_t burst = rate * TOKEN_SCALE / 1000 * RATE_BURST_MS;
+        uint64_t elapsed = now - last;
+        last = now;
+
+        if (elapsed >= static_cast<uint64_t>(RATE_BURST_MS) * 1000) {
+            tokens = burst;
+        }
+        else {
+            tokens = min<int64_t>(burst, tokens + elapsed * rate);
+        }
+
+        if (tokens <= 0) {
+            return false;
+        }
+
+        tokens -= cost * TOKEN_SCALE;
+        return true;
+    }
+
+    // Corrects an earlier take by cost, which may be negative (a refund).
+    void settle(int64_t cost) {
+        tokens -= cost * TOKEN_SCALE;
+    }
+};
+
+// Token buckets of sources of client messages, checked on the raw address
+// before the message is looked at. Sources are hashed into fixed tables, so
+// memory doesn't grow with spoofed addresses; sources sharing a slot share
+// its limit. A subnet is /24 for ip4 and /64 for ip6. Rate 0 turns a limit off.
+struct rate_limiter_t {
+    uint64_t address_rate = 0;
+    uint64_t subnet_rate = 0;
+    vector<token_bucket_t> addresses;
+    vector<token_bucket_t> subnets;
+
+    void configure(uint64_t new_address_rate, uint64_t new_subnet_rate) {
+        address_rate = new_address_rate;
+        subnet_rate = new_subnet_rate;
+        addresses.assign(address_rate ? 1 << ADDRESS_BUCKET_BITS : 0, token_bucket_t {});
+        subnets.assign(subnet_rate ? 1 << SUBNET_BUCKET_BITS : 0, token_bucket_t {});
+    }
+
+    // Multiplicative hash of key to given amount of bits.
+    static uint64_t hash(uint64_t key, int bits) {
+        return (key * 0x9e3779b97f4a7c15ull) >> (64 - bits);
+    }
+
+    // Takes a token of the message's source. Returns RATE_PASSED if the message
+    // may be processed, otherwise which limit it's over.
+    int check(const sockaddr_in6 &addr, uint64_t now) {
+        uint64_t high, low;
+        memcpy(&high, addr.sin6_addr.s6_addr, sizeof(high));
+        memcpy(&low, addr.sin6_addr.s6_addr + SUBNET6_BYTES, sizeof(low));
+
+        uint64_t subnet = high;
+        if (IN6_IS_ADDR_V4MAPPED(&addr.sin6_addr)) {
+            subnet = be64toh(low) >> (32 - SUBNET4_BITS);
+        }
+
+        if (address_rate && !addresses[hash(high ^ hash(low, 64), ADDRESS_BUCKET_BITS)].take(address_rate, 1, now)) {
+            return RATE_ADDRESS_SHED;
+        }
+        if (subnet_rate && !subnets[hash(subnet, SUBNET_BUCKET_BITS)].take(subnet_rate, 1, now)) {
+            return RATE_SUBNET_SHED;
+        }
+
+        return RATE_PASSED;
+    }
+};
+
+#endif
@@ -0,0 +1,371 @@
+#include "screen-worms-relay.h"
+
+// Returns current time in microseconds.
+uint64_t get_time() {
+    timeval tv {};
+    gettimeofday(&tv, nullptr);
+    return tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// Parses options. First argument from command line is taken for upstream's address.
+void update_options(memory_relay_t &mem, int argc, char *argv[]) {
+    int opt;
+
+    if (argc < 2) {
+        cout<<"missing upstream address"<<endl;
+        exit(1);
+    }
+
+    mem.upstream_ip = argv[1];
+
+    while ((opt = getopt(argc - 1, &argv[1], "p:l:u:r:R:c:")) != -1) {
+        if (opt == '?') {
+            cout<<"unknown option"<<endl;
+            exit(1);
+        }
+
+        char *ptr;
+        uint32_t val = strtol(optarg, &ptr, 10);
+
+        if (*ptr != 0) {
+            cout<<"incorrect option value"<<endl;
+            exit(1);
+        }
+
+        if (opt == 'p') {
+            mem.upstream_port = optarg;
+        }
+        else if (opt == 'l') {
+            mem.PORT_NUM = val;
+        }
+        else if (opt == 'u') {
+            if (val < MAX_UDP || val > MAX_DATAGRAM) {
+                cout<<"incorrect datagram size"<<endl;
+                exit(1);
+            }
+            mem.DATAGRAM_SIZE = val;
+        }
+        else if (opt == 'r') {
+            mem.ADDRESS_RATE = val;
+        }
+        else if (opt == 'R') {
+            mem.SUBNET_RATE = val;
+        }
+        else if (opt == 'c') {
+            if (val < 1) {
+                cout<<"incorrect clients limit"<<endl;
+                exit(1);
+            }
+            mem.MAX_CLIENTS = val;
+        }
+    }
+
+    mem.limiter.configure(mem.ADDRESS_RATE, mem.SUBNET_RATE);
+}
+
+// Creates socket connected to the upstream (server or another relay)
+// and registers it in epoll.
+int connect_upstream(memory_relay_t &mem) {
+    addrinfo *addr = mem.upstream_addr;
+    int sock = socket(addr->ai_family, addr->ai_socktype | SOCK_NONBLOCK, addr->ai_protocol);
+
+    if (sock < 0 || connect(sock, addr->ai_addr, addr->ai_addrlen) < 0) {
+        cout<<"socket"<<endl;
+        exit(1);
+    }
+
+    epoll_event event {};
+    event.events = EPOLLIN;
+    event.data.fd = sock;
+    epoll_ctl(mem.epoll_fd, EPOLL_CTL_ADD, sock, &event);
+
+    return sock;
+}
+
+// Creates ip6 socket (accepting also ip4 clients) on which the relay
+// serves its clients, and the subscription socket towards the upstream.
+void create_sockets(memory_relay_t &mem) {
+    addrinfo addr_hints {};
+    addr_hints.ai_family = AF_UNSPEC;
+    addr_hints.ai_socktype = SOCK_DGRAM;
+    addr_hints.ai_protocol = IPPROTO_UDP;
+
+    if (getaddrinfo(mem.upstream_ip.c_str(), mem.upstream_port.c_str(), &addr_hints, &mem.upstream_addr) != 0) {
+        cout<<"addr info"<<endl;
+        exit(1);
+    }
+
+    mem.sock = socket(AF_INET6, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    int v6OnlyEnabled = 0;
+
+    if (mem.sock < 0 ||
+        setsockopt(mem.sock, IPPROTO_IPV6, IPV6_V6ONLY, &v6OnlyEnabled, sizeof(v6OnlyEnabled)) != 0) {
+        cout<<"socket"<<endl;
+        exit(1);
+    }
+
+    sockaddr_in6 local_addr {};
+    local_addr.sin6_family = AF_INET6;
+    local_addr.sin6_addr = in6addr_any;
+    local_addr.sin6_port = htons(mem.PORT_NUM);
+
+    if (bind(mem.sock, (sockaddr*) &local_addr, sizeof(local_addr)) < 0) {
+        cout<<"bind"<<endl;
+        exit(1);
+    }
+
+    mem.epoll_fd = epoll_create1(0);
+    epoll_event event {};
+    event.events = EPOLLIN;
+    event.data.fd = mem.sock;
+    epoll_ctl(mem.epoll_fd, EPOLL_CTL_ADD, mem.sock, &event);
+
+    mem.upstream = connect_upstream(mem);
+}
+
+// Sends message to the upstream on given socket. The relay asks for
+// the events it's missing and for datagrams as big as its clients may take.
+// It ingests events as they are, so it never asks for compression.
+void send_upstream(memory_relay_t &mem, int sock, client_mess_t mess) {
+    mess.session_id = htobe64(mess.session_id);
+    mess.next_expected_event_no = htobe32(mem.synced ? mem.events.size() : 0);
+    mess.padding = min<uint32_t>(mem.DATAGRAM_SIZE / DATAGRAM_UNIT, BYTE_RANGE - 1);
+    mess.flags = 0;
+
+    send(sock, &mess, sizeof(mess), 0);
+}
+
+// Keeps the relay subscribed to the upstream as a spectator.
+void send_subscription(memory_relay_t &mem) {
+    client_mess_t mess {};
+    mess.session_id = mem.session_id;
+
+    send_upstream(mem, mem.upstream, mess);
+}
+
+// Forgets the log and starts a new game with given id.
+void reset_log(memory_relay_t &mem, uint32_t game_id) {
+    mem.game_id = game_id;
+    mem.synced = true;
+    mem.events.clear();
+    mem.broadcast_events = 0;
+}
+
+// Appends events from datagram sent by the upstream to the log. Events are
+// taken strictly in order, like the client does, and the rest of datagram
+// is dropped at the first unexpected or damaged one. Datagram of unknown
+// game which doesn't start it makes the relay ask for the log from the beginning.
+void ingest(memory_relay_t &mem, uint8_t *buff, size_t size) {
+    uint64_t head = game_id_layout::size + event_len_layout::size + event_head_layout::size;
+
+    if (size < head) {
+        return;
+    }
+
+    uint64_t offset = 0;
+    auto [game_id] = game_id_layout::decode(buff, offset);
+    uint64_t first = game_id_layout::size + event_len_layout::size;
+    bool starts_game = buff[head - BYTE] == NEW_GAME_TYPE && convert_bytes_to_number(buff, first, DWORD) == 0;
+
+    if (starts_game && (game_id != mem.game_id || !mem.synced)) {
+        reset_log(mem, game_id);
+    }
+    else if (game_id != mem.game_id) {
+        mem.synced = false;
+        return;
+    }
+
+    while (offset + event_len_layout::size + event_head_layout::size <= size) {
+        uint64_t event_offset = offset;
+        auto [len] = event_len_layout::decode(buff, offset);
+        auto [event_no, event_type] = event_head_layout::decode(buff, offset);
+        uint64_t event_size = event_len_layout::size + len + crc_layout::size;
+        (void) event_type;
+
+        if (event_no != mem.events.size() || len < event_head_layout::size || event_offset + event_size > size) {
+            return;
+        }
+
+        uint64_t crc_offset = event_offset + event_len_layout::size + len;
+        auto [crc] = crc_layout::decode(buff, crc_offset);
+
+        if (crc != calculate_crc32(buff + event_offset, event_len_layout::size + len)) {
+            return;
+        }
+
+        memcpy(mem.events.append(event_size), buff + event_offset, event_size);
+        offset = event_offset + event_size;
+    }
+}
+
+// Returns id of the client with given address.
+string get_client_id(sockaddr_in6 &addr) {
+    return string(reinterpret_cast<char*>(&addr.sin6_addr), sizeof(addr.sin6_addr)) +
+           string(reinterpret_cast<char*>(&addr.sin6_port), sizeof(addr.sin6_port));
+}
+
+// Sends events from next_expected_event_no to the client out of relay's log.
+void send_events_to_client(memory_relay_t &mem, relay_client_t &client, uint32_t next_expected_event_no) {
+    if (pack_events(mem.datagrams, mem.game_id, mem.events, next_expected_event_no,
+                    &client.addr, &client.datagram_size, 1) > 0) {
+        send_datagrams(mem.sock, mem.datagrams);
+    }
+}
+
+// Handles message from client: answers with events it's missing
+// and forwards it upstream if it comes from a player. Messages over
+// the rate limits and from new clients over the clients limit are dropped.
+void read_from_client(memory_relay_t &mem, client_mess_t &mess, size_t len, sockaddr_in6 &addr, uint64_t now) {
+    if (len < RELAY_MESS_MIN || len > sizeof(client_mess_t)) {
+        return;
+    }
+
+    if ((mem.ADDRESS_RATE || mem.SUBNET_RATE) && mem.limiter.check(addr, monotonic_time()) != RATE_PASSED) {
+        return;
+    }
+
+    string id = get_client_id(addr);
+    auto it = mem.clients.find(id);
+
+    if (it == mem.clients.end()) {
+        if (mem.clients.size() >= mem.MAX_CLIENTS) {
+            return;
+        }
+        it = mem.clients.emplace(id, relay_client_t {}).first;
+    }
+
+    relay_client_t &client = it->second;
+    client.addr = addr;
+    client.last_seen = now;
+    client.datagram_size = MAX_UDP;
+
+    if (len >= CLIENT_MESS_PADDED && mess.padding != 0) {
+        client.datagram_size = min<uint32_t>(max<uint32_t>(MAX_UDP, mess.padding * DATAGRAM_UNIT), mem.DATAGRAM_SIZE);
+    }
+
+    if (mem.synced) {
+        send_events_to_client(mem, client, be32toh(mess.next_expected_event_no));
+    }
+
+    if (mess.player_name[0] != '\0') {
+        if (client.upstream < 0) {
+            client.upstream = connect_upstream(mem);
+        }
+
+        mess.session_id = be64toh(mess.session_id);
+        send_upstream(mem, client.upstream, mess);
+    }
+}
+
+// Reads all datagrams from the socket of given epoll entry.
+void read_datagrams(memory_relay_t &mem, int fd, uint64_t now) {
+    static uint8_t buff[MAX_DATAGRAM];
+
+    while (true) {
+        sockaddr_in6 addr {};
+        socklen_t addr_len = sizeof(addr);
+        int size;
+
+        if (fd == mem.sock) {
+            size = recvfrom(mem.sock, buff, sizeof(buff), MSG_TRUNC, (sockaddr*) &addr, &addr_len);
+        }
+        else {
+            size = recv(fd, buff, sizeof(buff), 0);
+        }
+
+        if (size < 0) {
+            return;
+        }
+
+        if (fd == mem.sock) {
+            client_mess_t mess {};
+            memcpy(&mess, buff, min<size_t>(size, sizeof(mess)));
+            read_from_client(mem, mess, size, addr, now);
+        }
+        else {
+            ingest(mem, buff, size);
+        }
+    }
+}
+
+// Sends events which came from the upstream since the last call to all clients.
+void broadcast(memory_relay_t &mem) {
+    if (mem.broadcast_events >= mem.events.size()) {
+        return;
+    }
+
+    mem.addrs.clear();
+    mem.datagram_sizes.clear();
+
+    for (auto &it : mem.clients) {
+        mem.addrs.push_back(it.second.addr);
+        mem.datagram_sizes.push_back(it.second.datagram_size);
+    }
+
+    if (pack_events(mem.datagrams, mem.game_id, mem.events, mem.broadcast_events,
+                    mem.addrs.data(), mem.datagram_sizes.data(), mem.addrs.size()) > 0) {
+        send_datagrams(mem.sock, mem.datagrams);
+    }
+
+    mem.broadcast_events = mem.events.size();
+}
+
+// Disconnects clients which haven't sent anything for too long.
+void drop_silent_clients(memory_relay_t &mem, uint64_t now) {
+    for (auto it = mem.clients.begin(); it != mem.clients.end(); ) {
+        if (it->second.last_seen + RELAY_TIMEOUT < now) {
+            if (it->second.upstream >= 0) {
+                close(it->second.upstream);
+            }
+            it = mem.clients.erase(it);
+        }
+        else {
+            it++;
+        }
+    }
+}
+
+// Main loop: keeps the subscription alive, takes events from the upstream,
+// serves clients and passes new events on to them.
+void run(memory_relay_t &mem) {
+    static epoll_event events[RELAY_EPOLL_BATCH];
+
+    uint64_t now = get_time();
+    mem.session_id = now;
+    mem.next_message = now;
+    mem.next_sweep = now + RELAY_SWEEP_SPAN;
+
+    while (true) {
+        now = get_time();
+
+        while (mem.next_message <= now) {
+            send_subscription(mem);
+            mem.next_message += RELAY_MESSAGE_SPAN;
+        }
+
+        if (mem.next_sweep <= now) {
+            drop_silent_clients(mem, now);
+            mem.next_sweep += RELAY_SWEEP_SPAN;
+        }
+
+        uint64_t deadline = min(mem.next_message, mem.next_sweep);
+        int wait = deadline > now ? (deadline - now + 999) / 1000 : 0;
+        int ready = epoll_wait(mem.epoll_fd, events, RELAY_EPOLL_BATCH, wait);
+        now = get_time();
+
+        for (int i = 0; i < ready; i++) {
+            read_datagrams(mem, events[i].data.fd, now);
+        }
+
+        broadcast(mem);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    memory_relay_t mem {};
+
+    update_options(mem, argc, argv);
+    create_sockets(mem);
+
+    run(mem);
+}
@@ -0,0 +1,76 @@
+#ifndef SK_SCREEN_WORMS_RELAY_H
+#define SK_SCREEN_WORMS_RELAY_H
+
+#include <bits/stdc++.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/time.h>
+#include <endian.h>
+
+#include "common.h"
+#include "screen-worms-events.h"
+#include "screen-worms-ratelimit.h"
+
+using namespace std;
+
+enum constants_relay {
+    RELAY_MESSAGE_SPAN = 30000,
+    RELAY_TIMEOUT = 2000000,
+    RELAY_SWEEP_SPAN = 100000,
+    RELAY_EPOLL_BATCH = 256,
+    RELAY_MESS_MIN = CLIENT_MESS_PADDED - PLAYER_NAME_LENGTH - BYTE,
+    // Clients send a message every 30 ms, so this lets a few share an address.
+    RELAY_ADDRESS_RATE = 200,
+    RELAY_MAX_CLIENTS = 1024,
+};
+
+// Client connected to the relay. Players get their own socket towards
+// the upstream, through which their messages are forwarded, so the game
+// server sees every player separately. Spectators are served by the relay only.
+struct relay_client_t {
+    sockaddr_in6 addr {};
+    uint32_t datagram_size = MAX_UDP;
+    uint64_t last_seen = 0;
+    int upstream = -1;
+};
+
+struct memory_relay_t {
+    string upstream_ip;
+    string upstream_port = "2021";
+    uint16_t PORT_NUM = 2022;
+    uint32_t DATAGRAM_SIZE = MAX_UDP;
+    uint32_t ADDRESS_RATE = RELAY_ADDRESS_RATE;
+    uint32_t SUBNET_RATE = 0;
+    uint32_t MAX_CLIENTS = RELAY_MAX_CLIENTS;
+
+    addrinfo *upstream_addr = nullptr;
+    int sock = -1;
+    int upstream = -1;
+    int epoll_fd = -1;
+    uint64_t session_id = 0;
+    uint64_t next_message = 0;
+    uint64_t next_sweep = 0;
+
+    // Copy of the upstream's event log of the current game. Until the first
+    // event of a game arrives the relay asks for the log from the beginning.
+    uint32_t game_id = 0;
+    bool synced = false;
+    event_log_t events;
+    size_t broadcast_events = 0;
+
+    // Messages over the limits are dropped before a client is looked up,
+    // and new clients aren't taken when there are MAX_CLIENTS of them, so
+    // spoofed sources can't make the relay keep them or send them catch-ups.
+    rate_limiter_t limiter;
+    map<string, relay_client_t> clients;
+    datagrams_t datagrams;
+    vector<sockaddr_in6> addrs;
+    vector<uint32_t> datagram_sizes;
+};
+
+#endif
@@ -0,0 +1,178 @@
+#include "screen-worms-replay.h"
+
+// Returns current time in microseconds.
+uint64_t get_time() {
+    timeval tv {};
+    gettimeofday(&tv, nullptr);
+    return tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// Parses options. First argument from command line is taken for server's address.
+void update_options(memory_replay_t &mem, int argc, char *argv[]) {
+    int opt;
+
+    if (argc < 2) {
+        cout<<"missing server address"<<endl;
+        exit(1);
+    }
+
+    mem.server_ip = argv[1];
+
+    while ((opt = getopt(argc - 1, &argv[1], "p:f:x:n:")) != -1) {
+        if (opt == '?') {
+            cout<<"unknown option"<<endl;
+            exit(1);
+        }
+
+        if (opt == 'p') {
+            mem.server_port = optarg;
+            continue;
+        }
+        if (opt == 'f') {
+            mem.trace_path = optarg;
+            continue;
+        }
+
+        char *ptr;
+        uint32_t val = strtol(optarg, &ptr, 10);
+
+        if (*ptr != 0) {
+            cout<<"incorrect option value"<<endl;
+            exit(1);
+        }
+
+        if (opt == 'x') {
+            mem.speed = val;
+        }
+        else if (opt == 'n') {
+            mem.loops = max<uint32_t>(val, 1);
+        }
+    }
+
+    if (mem.trace_path.empty()) {
+        cout<<"missing trace"<<endl;
+        exit(1);
+    }
+}
+
+// Reads the whole trace. Every distinct source address gets its number.
+void load_trace(memory_replay_t &mem) {
+    ifstream in(mem.trace_path, ios::binary);
+    trace_header_t header {};
+    map<pair<array<uint8_t, 16>, uint16_t>, uint32_t> sources;
+
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        header.magic != TRACE_MAGIC || header.version != TRACE_VERSION) {
+        cout<<"incorrect trace"<<endl;
+        exit(1);
+    }
+
+    trace_record_t record {};
+
+    while (in.read(reinterpret_cast<char*>(&record), sizeof(record))) {
+        replayed_datagram_t datagram {};
+        datagram.time = record.time;
+        datagram.len = min<uint32_t>(record.len, MAX_DATAGRAM);
+
+        if (!in.read(reinterpret_cast<char*>(datagram.payload), min<size_t>(datagram.len, TRACE_MAX_PAYLOAD))) {
+            break;
+        }
+
+        array<uint8_t, 16> addr;
+        memcpy(addr.data(), record.addr, addr.size());
+        uint16_t port = record.port;
+        auto it = sources.emplace(make_pair(addr, port), sources.size()).first;
+        datagram.source = it->second;
+
+        mem.datagrams.push_back(datagram);
+    }
+
+    mem.sources.resize(sources.size(), -1);
+}
+
+// Creates one socket per source of the trace, so the server sees
+// as many clients as were recorded.
+void create_sockets(memory_replay_t &mem) {
+    addrinfo addr_hints {};
+    addr_hints.ai_family = AF_UNSPEC;
+    addr_hints.ai_socktype = SOCK_DGRAM;
+    addr_hints.ai_protocol = IPPROTO_UDP;
+
+    if (getaddrinfo(mem.server_ip.c_str(), mem.server_port.c_str(), &addr_hints, &mem.server_addr) != 0) {
+        cout<<"addr info"<<endl;
+        exit(1);
+    }
+
+    addrinfo *addr = mem.server_addr;
+
+    for (int &sock : mem.sources) {
+        sock = socket(addr->ai_family, addr->ai_socktype | SOCK_NONBLOCK, addr->ai_protocol);
+
+        if (sock < 0 || connect(sock, addr->ai_addr, addr->ai_addrlen) < 0) {
+            cout<<"socket"<<endl;
+            exit(1);
+        }
+    }
+}
+
+// Waits until given time: sleeps most of the way and spins the rest.
+void wait_until(uint64_t due) {
+    uint64_t now = get_time();
+
+    if (due > now + REPLAY_SPIN) {
+        usleep(due - now - REPLAY_SPIN);
+    }
+
+    while (get_time() < due) {
+    }
+}
+
+// Sends the trace (loops times) keeping its timing scaled by speed.
+// Speed 0 sends everything as fast as possible.
+void replay(memory_replay_t &mem) {
+    static uint8_t buff[MAX_DATAGRAM] {};
+
+    uint64_t span = mem.datagrams.empty() ? 0 : mem.datagrams.back().time + 1;
+    uint64_t start = get_time();
+
+    for (uint32_t loop = 0; loop < mem.loops; loop++) {
+        for (replayed_datagram_t &datagram : mem.datagrams) {
+            if (mem.speed != 0) {
+                uint64_t due = start + (loop * span + datagram.time) / mem.speed;
+                wait_until(due);
+
+                uint64_t lateness = get_time() - due;
+                mem.lateness_sum += lateness;
+                mem.lateness_max = max(mem.lateness_max, lateness);
+            }
+
+            memcpy(buff, datagram.payload, min<size_t>(datagram.len, TRACE_MAX_PAYLOAD));
+
+            if (send(mem.sources[datagram.source], buff, datagram.len, 0) < 0) {
+                mem.failed++;
+            }
+            else {
+                mem.sent++;
+            }
+        }
+    }
+
+    uint64_t duration = get_time() - start;
+    uint64_t cnt = mem.datagrams.size() * mem.loops;
+
+    cout<<"datagrams="<<cnt<<" sources="<<mem.sources.size()<<" speed="<<mem.speed
+        <<" duration_us="<<duration<<" rate_per_s="<<(duration ? cnt * 1000000 / duration : 0)
+        <<" sent="<<mem.sent<<" failed="<<mem.failed
+        <<" lateness_mean_us="<<(cnt ? mem.lateness_sum / cnt : 0)
+        <<" lateness_max_us="<<mem.lateness_max<<endl;
+}
+
+int main(int argc, char *argv[]) {
+    memory_replay_t mem {};
+
+    update_options(mem, argc, argv);
+    load_trace(mem);
+    create_sockets(mem);
+
+    replay(mem);
+}
@@ -0,0 +1,47 @@
+#ifndef SK_SCREEN_WORMS_REPLAY_H
+#define SK_SCREEN_WORMS_REPLAY_H
+
+#include <bits/stdc++.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/time.h>
+
+#include "common.h"
+#include "screen-worms-trace.h"
+
+using namespace std;
+
+enum constants_replay {
+    REPLAY_SPIN = 200,
+};
+
+// Datagram of the trace, sent from the socket of its original source.
+struct replayed_datagram_t {
+    uint64_t time;
+    uint32_t source;
+    uint16_t len;
+    uint8_t payload[TRACE_MAX_PAYLOAD];
+};
+
+struct memory_replay_t {
+    string server_ip;
+    string server_port = "2021";
+    string trace_path;
+    uint32_t speed = 1;
+    uint32_t loops = 1;
+
+    addrinfo *server_addr = nullptr;
+    vector<replayed_datagram_t> datagrams;
+    vector<int> sources;
+
+    uint64_t sent = 0;
+    uint64_t failed = 0;
+    uint64_t lateness_max = 0;
+    uint64_t lateness_sum = 0;
+};
+
+#endif
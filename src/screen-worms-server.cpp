@@ -1,25 +1,23 @@
 #include "screen-worms-server.h"
 #include "common.h"
+#include "screen-worms-checkpoint.h"
+#include "screen-worms-local.h"
+#include "screen-worms-spectators.h"
 #include <sys/time.h>
 
-// Random number generator.
+// Random number generator. Its state is kept in memory, so it can be checkpointed.
 uint32_t my_rand(memory_server_t &mem) {
-    static uint32_t r = mem.SEED;
-    uint32_t result = r;
-    uint64_t new_r = r;
+    uint32_t result = mem.rand_state;
+    uint64_t new_r = mem.rand_state;
     new_r *= RAND_MULT;
     new_r %= RAND_MOD;
-    r = new_r;
+    mem.rand_state = new_r;
     return result;
 }
 
-// Sets the board to initial state.
+// Sets the board to initial state. Only tiles painted in the previous game are cleared.
 void clean_board(memory_server_t &mem) {
-    for (int i = 0; i < mem.WIDTH; i++) {
-        for (int j = 0; j < mem.HEIGHT; j++) {
-            mem.board[i][j] = false;
-        }
-    }
+    mem.board.reset(mem.WIDTH, mem.HEIGHT);
 }
 
 // Parses options and their values as it is said in the task.
@@ -27,12 +25,25 @@ void clean_board(memory_server_t &mem) {
 void update_options(memory_server_t &mem, int argc, char *argv[]) {
     int opt;
 
-    while ((opt = getopt(argc, argv, "p:s:t:v:w:h:")) != -1) {
+    while ((opt = getopt(argc, argv, "p:s:t:v:w:h:u:a:b:T:m:c:l:H:f:W:k:K:r:R:e:L:C:I:G:")) != -1) {
         if (opt == '?') {
             cout<<"Unknown option"<<endl;
             exit(1);
         }
 
+        if (opt == 'k') {
+            mem.CHECKPOINT_PATH = optarg;
+            continue;
+        }
+        if (opt == 'L') {
+            mem.SHM_NAME = optarg;
+            continue;
+        }
+        if (opt == 'C') {
+            mem.CAPTURE_PATH = optarg;
+            continue;
+        }
+
         char *ptr;
         uint32_t val = strtol(optarg, &ptr, 10);
 
@@ -67,7 +78,94 @@ void update_options(memory_server_t &mem, int argc, char *argv[]) {
             }
             mem.HEIGHT = val;
         }
+        else if (opt == 'u') {
+            if (val < MAX_UDP || val > MAX_DATAGRAM) {
+                cout<<"incorrect datagram size"<<endl;
+                exit(1);
+            }
+            mem.DATAGRAM_SIZE = val;
+        }
+        else if (opt == 'a') {
+            if (val > MAX_WORMS - MAX_PLAYERS - 1) {
+                cout<<"too many bots"<<endl;
+                exit(1);
+            }
+            mem.BOTS = val;
+        }
+        else if (opt == 'b') {
+            if (val != BACKEND_SOCKETS && val != BACKEND_URING) {
+                cout<<"unknown backend"<<endl;
+                exit(1);
+            }
+            mem.BACKEND = val;
+        }
+        else if (opt == 'T') {
+            mem.PIPELINED = (val != 0);
+        }
+        else if (opt == 'm') {
+            mem.METRICS = (val != 0);
+        }
+        else if (opt == 'c') {
+            if (val >= CPU_SETSIZE) {
+                cout<<"incorrect cpu"<<endl;
+                exit(1);
+            }
+            mem.CPU = val;
+        }
+        else if (opt == 'l') {
+            mem.LOCK_MEMORY = (val != 0);
+        }
+        else if (opt == 'H') {
+            mem.HUGE_PAGES = (val != 0);
+        }
+        else if (opt == 'K') {
+            mem.CHECKPOINT_SPAN = val;
+        }
+        else if (opt == 'r') {
+            mem.ADDRESS_RATE = val;
+        }
+        else if (opt == 'R') {
+            mem.SUBNET_RATE = val;
+        }
+        else if (opt == 'e') {
+            mem.CATCH_UP_RATE = val;
+        }
+        else if (opt == 'W') {
+            mem.PRECISE_WAIT = (val != 0);
+        }
+        else if (opt == 'I') {
+            mem.LATENCY = (val != 0);
+        }
+        else if (opt == 'G') {
+            if (val > UINT16_MAX) {
+                cout<<"incorrect port"<<endl;
+                exit(1);
+            }
+            mem.SPECTATOR_PORT = val;
+        }
+        else if (opt == 'f') {
+            if (val > static_cast<uint32_t>(sched_get_priority_max(SCHED_FIFO))) {
+                cout<<"incorrect priority"<<endl;
+                exit(1);
+            }
+            mem.FIFO_PRIORITY = val;
+        }
+    }
+
+    if (mem.PIPELINED && mem.BACKEND == BACKEND_URING) {
+        cout<<"io_uring backend works only in single threaded mode"<<endl;
+        exit(1);
+    }
+
+    // Precise wait needs the time of the next turn, which in pipelined
+    // mode belongs to the simulation thread.
+    if (mem.PIPELINED && mem.PRECISE_WAIT) {
+        cout<<"precise wait works only in single threaded mode"<<endl;
+        exit(1);
     }
+
+    mem.rand_state = mem.SEED;
+    mem.limiter.configure(mem.ADDRESS_RATE, mem.SUBNET_RATE);
 }
 
 // Creates and binds ip6 socket to listen both from ip4 and ip6 clients.
@@ -87,6 +185,12 @@ void create_socket(memory_server_t &mem) {
         exit(1);
     }
 
+    int timestamps = 1;
+    if (mem.LATENCY && setsockopt(mem.sock, SOL_SOCKET, SO_TIMESTAMPNS, &timestamps, sizeof(timestamps)) != 0) {
+        cout<<"socket timestamps"<<endl;
+        exit(1);
+    }
+
     int v6OnlyEnabled = 0;
     if (setsockopt(mem.sock, IPPROTO_IPV6, IPV6_V6ONLY, &v6OnlyEnabled, sizeof(v6OnlyEnabled)) != 0) {
         cout<<"socket ip6 only disabled"<<endl;
@@ -97,9 +201,16 @@ void create_socket(memory_server_t &mem) {
     mem.local_addr.sin6_flowinfo = 0;
     mem.local_addr.sin6_addr = in6addr_any;
     mem.local_addr.sin6_port = htons(mem.PORT_NUM);
-    if (bind(mem.sock, (sockaddr*) &mem.local_addr, sizeof(mem.local_addr)) < 0) {
-        cout<<"bind"<<endl;
-        exit(1);
+    // Server restarted from checkpoint may find the port still held by the old
+    // one for a moment (io_uring releases its socket asynchronously).
+    int attempts = 0;
+    while (bind(mem.sock, (sockaddr*) &mem.local_addr, sizeof(mem.local_addr)) < 0) {
+        if (errno != EADDRINUSE || ++attempts == BIND_ATTEMPTS) {
+            cout<<"bind"<<endl;
+            exit(1);
+        }
+
+        usleep(BIND_RETRY_WAIT);
     }
 }
 
@@ -123,223 +234,402 @@ void set_timers(memory_server_t &mem) {
     mem.player_timeout.it_interval.tv_sec = 0;
 }
 
-// Divides number to bytes and place them at the end of data in Big Endian order.
-void encode_number(vector<uint8_t> &data, uint64_t number, uint8_t bytes) {
-    stack<uint8_t> s;
+// Calculates crc for len bytes of encoded event
+// and places it right after them in Big Endian order.
+void calculate_crc(uint8_t *data, uint64_t len) {
+    crc_layout::encode(data + len, calculate_crc32(data, len));
+}
+
+// Writes player's id, which is concatenation of player's address, '/'
+// and player's port (it's unique), to id. Memory of id is reused.
+void get_player_id(sockaddr_in6 &player_addr, string &id) {
+    char str[INET6_ADDRSTRLEN + 8];
+    inet_ntop(AF_INET6, player_addr.sin6_addr.s6_addr, str, INET6_ADDRSTRLEN);
+    size_t len = strlen(str);
+    len += snprintf(str + len, sizeof(str) - len, "/%u", player_addr.sin6_port);
+    id.assign(str, len);
+}
+
+// Returns player's id.
+string get_player_id(sockaddr_in6 &player_addr) {
+    string id;
+    get_player_id(player_addr, id);
+    return id;
+}
+
+// Sends events from next_expected_event_no to the most recent one to all given
+// addresses with sendmmsg (or in one batch through io_uring). Catch-up of
+// a client which asked for compression is compressed if it takes more than
+// one datagram. Returns amount of system calls made.
+int send_events(memory_server_t &mem, uint32_t game_id, event_log_t &events, uint32_t next_expected_event_no,
+                sockaddr_in6 *addrs, uint32_t *datagram_sizes, int addr_cnt, bool compression) {
+    static thread_local datagrams_t datagrams;
+    vector<mmsghdr> &msgs = datagrams.msgs;
+
+    // Enough for catching up on the whole reserved event log in smallest datagrams.
+    if (msgs.capacity() == 0) {
+        size_t per_datagram = MAX_UDP - game_id_layout::size;
+        datagrams.reserve(min(mem.events.offsets.capacity(), 2 * mem.events.data.capacity() / per_datagram + 1));
+    }
+
+    if (compression && addr_cnt == 1 && next_expected_event_no < events.size() &&
+        events.data.size() - events.offsets[next_expected_event_no] > datagram_sizes[0]) {
+        // The estimate charged by take_catch_up_budget is settled with the real size.
+        int64_t estimate = (events.data.size() - events.offsets[next_expected_event_no]) / COMPRESS_GUESS;
+        size_t packed = pack_compressed_events(datagrams, game_id, events, next_expected_event_no, addrs,
+                                               datagram_sizes[0]);
+        mem.catch_up_settlement += static_cast<int64_t>(datagrams.compressed_bytes) - estimate;
+
+        if (packed == 0) {
+            return 0;
+        }
+
+        mem.metrics.compressed_raw += datagrams.raw_bytes;
+        mem.metrics.compressed_sent += datagrams.compressed_bytes;
+    }
+    else if (pack_events(datagrams, game_id, events, next_expected_event_no, addrs, datagram_sizes, addr_cnt) == 0) {
+        return 0;
+    }
+
+    if (mem.uring) {
+        int syscalls = uring_send(*mem.uring, &msgs[0], msgs.size());
+
+        if (syscalls < 0) {
+            cout<<"send to client"<<endl;
+            exit(1);
+        }
 
-    for (int i = 0; i < bytes; i++) {
-        s.push(number % BYTE_RANGE);
-        number /= BYTE_RANGE;
+        return syscalls;
     }
 
-    while (!s.empty()) {
-        data.push_back(s.top());
-        s.pop();
+    int syscalls = send_datagrams(mem.sock, datagrams);
+
+    if (syscalls < 0) {
+        cout<<"send to client"<<endl;
+        exit(1);
     }
+
+    return syscalls;
 }
 
-// Calculates crc for given data
-// and places it at the end of data in Big Endian order.
-void calculate_crc(vector<uint8_t> &data) {
-    uint32_t crc = 0xFFFFFFFF;
+// Passes task to the send thread. Waits for free space if wait is set,
+// otherwise the task is dropped when the queue is full.
+void push_task(memory_server_t &mem, send_task_t &&task, bool wait) {
+    while (!mem.pipeline->tasks.push(std::move(task))) {
+        if (!wait) {
+            return;
+        }
 
-    for (size_t i = 0; i < data.size(); i++) {
-        uint64_t temp = (crc ^ data[i]) & 0xFF;
-        crc = (crc >> 8) ^ crc32_tab[temp];
+        usleep(RCV_WAIT);
     }
+}
 
-    crc = crc ^ 0xFFFFFFFF;
-    encode_number(data, crc, DWORD);
+// Copies events that the send thread doesn't know about yet to its queue.
+void publish_events(memory_server_t &mem) {
+    pipeline_t &pipeline = *mem.pipeline;
+
+    for (; pipeline.published_events < mem.events.size(); pipeline.published_events++) {
+        send_task_t task {};
+        task.type = TASK_EVENT;
+        const uint8_t *event = mem.events.event(pipeline.published_events);
+        task.event_size = mem.events.event_size(pipeline.published_events);
+        memcpy(task.event, event, task.event_size);
+        push_task(mem, std::move(task), true);
+    }
 }
 
-// Returns player's id which is concatenation of
-// player's address, '/' and player's port (it's unique).
-string get_player_id(sockaddr_in6 &player_addr) {
-    char str[INET6_ADDRSTRLEN];
-    inet_ntop(AF_INET6, player_addr.sin6_addr.s6_addr, str, INET6_ADDRSTRLEN);
-    string tmp = str;
-    return tmp + "/" + to_string(player_addr.sin6_port);
+// Takes bytes of catch-up from next_expected_event_no out of the global
+// egress budget. Returns false if the budget is used up. What fits in one
+// datagram is recovery of a lost one rather than catch-up and is free.
+// Compressed catch-up is charged an estimate of its compressed size, settled
+// with the bytes which actually went out once the sending thread knows them.
+bool take_catch_up_budget(memory_server_t &mem, uint32_t next_expected_event_no, uint32_t datagram_size,
+                          bool compression) {
+    if (mem.CATCH_UP_RATE == 0 || next_expected_event_no >= mem.events.size()) {
+        return true;
+    }
+
+    uint64_t bytes = mem.events.data.size() - mem.events.offsets[next_expected_event_no];
+
+    if (bytes <= datagram_size) {
+        return true;
+    }
+
+    mem.catch_up_budget.settle(mem.catch_up_settlement.exchange(0));
+
+    if (!mem.catch_up_budget.take(mem.CATCH_UP_RATE, compression ? bytes / COMPRESS_GUESS : bytes, monotonic_time())) {
+        mem.metrics.shed_catch_ups++;
+        return false;
+    }
+
+    return true;
 }
 
-// Sends events from next_expected_event_no to the most recent one to given client.
-// Tries to fit as many events in one datagram as it is possible.
-void send_events_to_client(memory_server_t &mem, uint32_t next_expected_event_no, sockaddr_in6 &client_addr) {
-    static uint8_t buff[MAX_UDP];
-	
-	if (next_expected_event_no < mem.events.size()) {
-		vector<uint8_t> game_id;
-		encode_number(game_id, mem.game_id, DWORD);
-		memcpy(buff, &game_id[0], DWORD);
-		uint64_t len = DWORD;
+// Sends events from next_expected_event_no to the most recent one to given player.
+// In pipelined mode the sending is left to the send thread. Catch-up over
+// the egress budget is skipped, the client will ask again. Latency of the
+// message is noted once it's answered, by the next broadcast if the client
+// is up to date.
+void send_events_to_client(memory_server_t &mem, uint32_t next_expected_event_no, player_t &player,
+                           latency_sample_t latency) {
+    if (!take_catch_up_budget(mem, next_expected_event_no, player.datagram_size, player.compression)) {
+        return;
+    }
 
-		for (size_t i = next_expected_event_no; i < mem.events.size(); i++) {
-		    if (len + mem.events[i].size() > MAX_UDP) {
-		        sendto(mem.sock, buff, len, 0, (sockaddr*) &client_addr, sizeof(client_addr));
-		        
-		        memcpy(buff, &game_id[0], DWORD);
-				len = DWORD;
-		    }
+    if (next_expected_event_no >= mem.events.size()) {
+        if (player.live_latency.received == 0) {
+            player.live_latency = latency;
+            player.live_event_no = next_expected_event_no;
+        }
+        return;
+    }
 
-		    memcpy(buff + len, &mem.events[i][0], mem.events[i].size());
-		    len += mem.events[i].size();
-		}
+    if (!mem.PIPELINED) {
+        mem.metrics.catch_up_syscalls += send_events(mem, mem.game_id, mem.events, next_expected_event_no,
+                                                     &player.addr, &player.datagram_size, 1, player.compression);
+        mem.metrics.latency.record(LATENCY_CATCH_UP, latency, latency.received ? realtime_ns() : 0);
+        return;
+    }
 
-		if (len != 0) {
-		    if (sendto(mem.sock, buff, len, 0, (sockaddr*) &client_addr, sizeof(client_addr)) <= 0) {
-		    	cout<<"send to client"<<endl;
-		    	exit(1);
-		    }
-		}
+    publish_events(mem);
+
+    send_task_t task {};
+    task.type = TASK_CATCH_UP;
+    task.from_event_no = next_expected_event_no;
+    task.addr_cnt = 1;
+    task.addrs[0] = player.addr;
+    task.datagram_sizes[0] = player.datagram_size;
+    task.compression = player.compression;
+    task.latency = latency;
+    push_task(mem, std::move(task), false);
+}
+
+// Notes latency of live messages answered by the broadcast which has just gone out.
+void record_live_latencies(memory_server_t &mem, send_task_t &task) {
+    if (!mem.LATENCY) {
+        return;
+    }
+
+    uint64_t replied = realtime_ns();
+
+    for (int i = 0; i < task.addr_cnt; i++) {
+        mem.metrics.latency.record(LATENCY_LIVE, task.live_latencies[i], replied);
     }
 }
 
 // Sends new events (the ones that haven't been sent before) to all clients.
+// Called once per turn, so all events of one turn go out together.
 void send_last_event_to_all_clients(memory_server_t &mem) {
-    for (auto it = mem.players.begin(); it != mem.players.end(); it++) {
-        send_events_to_client(mem, mem.last_event, it->second.addr);
+    publish_shared_events(mem);
+
+    if (static_cast<size_t>(mem.last_event) < mem.events.size()) {
+        send_task_t task {};
+        task.type = TASK_BROADCAST;
+        task.from_event_no = mem.last_event;
+
+        for (auto &it : mem.players) {
+            player_t &player = it.second;
+
+            if (player.local) {
+                continue;
+            }
+
+            if (player.live_latency.received != 0 && player.live_event_no < mem.events.size()) {
+                task.live_latencies[task.addr_cnt] = player.live_latency;
+                player.live_latency = {};
+            }
+
+            task.addrs[task.addr_cnt] = player.addr;
+            task.datagram_sizes[task.addr_cnt++] = player.datagram_size;
+        }
+
+        if (!mem.PIPELINED) {
+            mem.metrics.broadcast_syscalls += send_events(mem, mem.game_id, mem.events, task.from_event_no,
+                                                          task.addrs, task.datagram_sizes, task.addr_cnt, false);
+            record_live_latencies(mem, task);
+        }
+        else {
+            publish_events(mem);
+            push_task(mem, std::move(task), true);
+        }
     }
-    
+
     mem.last_event = mem.events.size();
 }
 
-// Adds encoded new game event to events vector. Player's names are stored in
+// Adds encoded new game event to the event log. Player's names are stored in
 // first element of vector order. The second element is player's id.
 void add_new_game_event(memory_server_t &mem, vector<pair<string, string>> &order) {
-    vector<uint8_t> new_event;
-    uint32_t len = EVENT_BASIC_LENGTH;
+    uint32_t len = new_game_event::len;
 
     for (auto &i : order) {
         len += i.first.size() + 1;
     }
 
-    encode_number(new_event, len, DWORD);
-    encode_number(new_event, mem.events.size(), DWORD);
-    encode_number(new_event, NEW_GAME_TYPE, BYTE);
-    encode_number(new_event, mem.WIDTH, DWORD);
-    encode_number(new_event, mem.HEIGHT, DWORD);
+    uint32_t event_no = mem.events.size();
+    uint8_t *event = mem.events.append(new_game_event::size + len - new_game_event::len);
+    uint8_t *data = new_game_event::encode_head(event, len, event_no);
+    data = new_game_layout::encode(data, mem.WIDTH, mem.HEIGHT);
 
     for (auto &i : order) {
-        for (char j : i.first) {
-            encode_number(new_event, j, BYTE);
-        }
-
-        encode_number(new_event, '\0', BYTE);
+        memcpy(data, i.first.c_str(), i.first.size() + 1);
+        data += i.first.size() + 1;
     }
 
-    calculate_crc(new_event);
-    mem.events.push_back(new_event);
-    //send_last_event_to_all_clients(mem);
+    calculate_crc(event, data - event);
 }
 
-// Adds encoded pixel event to events vector.
+// Adds encoded pixel event to the event log.
 void add_pixel_event(memory_server_t &mem, uint8_t player, uint32_t x, uint32_t y) {
-    vector<uint8_t> new_event;
-
-    encode_number(new_event, PIXEL_LENGTH, DWORD);
-    encode_number(new_event, mem.events.size(), DWORD);
-    encode_number(new_event, PIXEL_TYPE, BYTE);
-    encode_number(new_event, player, BYTE);
-    encode_number(new_event, x, DWORD);
-    encode_number(new_event, y, DWORD);
+    uint32_t event_no = mem.events.size();
+    uint8_t *event = mem.events.append(pixel_event::size);
 
-    calculate_crc(new_event);
-    mem.events.push_back(new_event);
-    //send_last_event_to_all_clients(mem);
+    calculate_crc(event, pixel_event::encode(event, event_no, player, x, y) - event);
 }
 
-// Add encoded eliminated event to events vector.
+// Add encoded eliminated event to the event log.
 void add_eliminated_event(memory_server_t &mem, uint8_t player) {
-    vector<uint8_t> new_event;
+    uint32_t event_no = mem.events.size();
+    uint8_t *event = mem.events.append(eliminated_event::size);
 
-    encode_number(new_event, ELIMINATED_LENGTH, DWORD);
-    encode_number(new_event, mem.events.size(), DWORD);
-    encode_number(new_event, ELIMINATED_TYPE, BYTE);
-    encode_number(new_event, player, BYTE);
-
-    calculate_crc(new_event);
-    mem.events.push_back(new_event);
-    send_last_event_to_all_clients(mem);
+    calculate_crc(event, eliminated_event::encode(event, event_no, player) - event);
 }
 
-// Add encoded game over event to events vector.
+// Add encoded game over event to the event log.
 void add_game_over_event(memory_server_t &mem) {
-	for (auto &it : mem.players) {
+    for (auto &it : mem.players) {
         it.second.ready = false;
     }
+    mem.ready_players = 0;
 
-    vector<uint8_t> new_event;
+    uint32_t event_no = mem.events.size();
+    uint8_t *event = mem.events.append(game_over_event::size);
 
-    encode_number(new_event, GAME_OVER_LENGTH, DWORD);
-    encode_number(new_event, mem.events.size(), DWORD);
-    encode_number(new_event, GAME_OVER_TYPE, BYTE);
+    calculate_crc(event, game_over_event::encode(event, event_no) - event);
+}
+
+// Sets turn direction of every bot: it turns right if the pixel straight
+// ahead is taken or outside of the board.
+void steer_bots(memory_server_t &mem) {
+    worms_t &worms = mem.worms;
+
+    for (size_t i = 0; i < worms.size(); i++) {
+        if (!worms.bot[i] || worms.eliminated[i]) {
+            continue;
+        }
+
+        int x = floor(worms.pos_x[i] + 2 * direction_cos(worms.direction[i]));
+        int y = floor(worms.pos_y[i] + 2 * direction_sin(worms.direction[i]));
+        bool blocked = (x < 0 || mem.WIDTH <= x || y < 0 || mem.HEIGHT <= y || mem.board.get(x, y));
 
-    calculate_crc(new_event);
-    mem.events.push_back(new_event);
-   // send_last_event_to_all_clients(mem);
+        worms.turn_direction[i] = blocked ? RIGHT : STRAIGHT;
+    }
 }
 
 // Makes moves of all remaining worms. Returns true
 // if the game ended during this turn. Updates all encountered events and sends them at the end.
+// Worms are moved all at once (with vector instructions if possible), then their
+// new pixels are checked one by one in worm order, so the result is the same as
+// when moving and checking each worm separately.
 bool make_moves(memory_server_t &mem) {
-    for (size_t i = 0; i < mem.worms.size(); i++) {
-        worm_t *worm = &mem.worms[i];
+    worms_t &worms = mem.worms;
 
-        if (!worm->eliminated) {
-            int old_x = floor(worm->pos_x);
-            int old_y = floor(worm->pos_y);
+    steer_bots(mem);
+    move_worms(worms, mem.TURNING_SPEED, mem.SIMD_LEVEL);
 
-            if (worm->turn_direction == RIGHT) {
-                worm->direction += mem.TURNING_SPEED;
-            }
-            else if (worm->turn_direction == LEFT) {
-                worm->direction += 360 - mem.TURNING_SPEED;
-            }
-            worm->direction %= 360;
-
-            worm->pos_x += cos(worm->direction * M_PI / 180);
-            worm->pos_y += sin(worm->direction * M_PI / 180);
-            int new_x = floor(worm->pos_x);
-            int new_y = floor(worm->pos_y);
-
-            if (old_x != new_x || old_y != new_y) {
-                if (new_x < 0 || mem.WIDTH <= new_x || new_y < 0 || mem.HEIGHT <= new_y ||
-                    mem.board[new_x][new_y]) {
-                    mem.worms_alive--;
-                    worm->eliminated = true;
-                    add_eliminated_event(mem, i);
-
-                    if (mem.worms_alive == 1) {
-                        add_game_over_event(mem);
-                        send_last_event_to_all_clients(mem);
-                        
-                        return true;
-                    }
-                }
-                else {
-                    mem.board[new_x][new_y] = true;
-                    add_pixel_event(mem, i, new_x, new_y);
+    for (size_t i = 0; i < worms.size(); i++) {
+        if (worms.eliminated[i]) {
+            continue;
+        }
+
+        int new_x = worms.new_x[i];
+        int new_y = worms.new_y[i];
+
+        if (worms.cell_x[i] != new_x || worms.cell_y[i] != new_y) {
+            worms.cell_x[i] = new_x;
+            worms.cell_y[i] = new_y;
+
+            if (new_x < 0 || mem.WIDTH <= new_x || new_y < 0 || mem.HEIGHT <= new_y ||
+                mem.board.get(new_x, new_y)) {
+                mem.worms_alive--;
+                worms.eliminated[i] = true;
+                add_eliminated_event(mem, i);
+
+                if (mem.worms_alive == 1) {
+                    add_game_over_event(mem);
+                    send_last_event_to_all_clients(mem);
+
+                    return true;
                 }
             }
+            else {
+                mem.board.set(new_x, new_y);
+                add_pixel_event(mem, i, new_x, new_y);
+            }
         }
     }
-	
-	send_last_event_to_all_clients(mem);
+
+    send_last_event_to_all_clients(mem);
     return false;
 }
 
+// Does the part of starting a game which doesn't depend on players: clears
+// the board and worms and names the bots. Called as soon as the previous game is over,
+// so initialize_game is left with little to do once the game may start.
+void prepare_next_game(memory_server_t &mem) {
+    next_game_t &next = mem.next_game;
+
+    if (next.prepared) {
+        return;
+    }
+
+    // Worms of the finished game are gone, players get new ones in initialize_game.
+    for (auto &it : mem.players) {
+        it.second.worm_num = -1;
+    }
+
+    mem.worms.clear();
+    clean_board(mem);
+
+    // Bots have empty player's id.
+    if (next.bots.size() != static_cast<size_t>(mem.BOTS)) {
+        next.bots.clear();
+
+        for (int i = 0; i < mem.BOTS; i++) {
+            next.bots.emplace_back("bot" + to_string(i), "");
+        }
+
+        sort(next.bots.begin(), next.bots.end());
+    }
+
+    next.prepared = true;
+}
+
 // Creates worms (in proper order) and generates their positions.
 // Updates all encountered events and sets the game turn timer as well.
 bool initialize_game(memory_server_t &mem) {
+    prepare_next_game(mem);
+    mem.next_game.prepared = false;
+
+    // Events of the new game are numbered from 0 again.
     for (auto &it : mem.players) {
         it.second.worm_num = -1;
+        it.second.live_latency = {};
     }
 
-    mem.worms.clear();
     mem.events.clear();
     mem.last_event = 0;
-    clean_board(mem);
     mem.game_id = my_rand(mem);
 
+    if (mem.PIPELINED) {
+        mem.pipeline->published_events = 0;
+
+        send_task_t task {};
+        task.type = TASK_NEW_LOG;
+        task.game_id = mem.game_id;
+        push_task(mem, std::move(task), true);
+    }
+
     vector<pair<string, string>> order;
 
     for (auto &player : mem.players) {
@@ -347,44 +637,50 @@ bool initialize_game(memory_server_t &mem) {
             order.emplace_back(player.second.name, player.first);
         }
     }
-    
-    mem.worms_alive = order.size();
+
     sort(order.begin(), order.end());
+    order.insert(order.end(), mem.next_game.bots.begin(), mem.next_game.bots.end());
+    inplace_merge(order.begin(), order.end() - mem.next_game.bots.size(), order.end());
+    mem.worms_alive = order.size();
     add_new_game_event(mem, order);
 
     for (size_t i = 0; i < order.size(); i++) {
         string id = order[i].second;
+        bool bot = id.empty();
+        int turn_direction = STRAIGHT;
+
+        if (!bot) {
+            mem.players[id].worm_num = i;
+            turn_direction = mem.players[id].turn_direction;
+        }
+
+        double pos_x = (my_rand(mem) % mem.WIDTH) + 0.5;
+        double pos_y = (my_rand(mem) % mem.HEIGHT) + 0.5;
+        int direction = my_rand(mem) % 360;
+        bool eliminated = false;
+
+        int x = floor(pos_x);
+        int y = floor(pos_y);
 
-        mem.players[id].worm_num = i;
-
-        worm_t worm {};
-        worm.eliminated = false;
-        worm.turn_direction = mem.players[id].turn_direction;
-        worm.pos_x = (my_rand(mem) % mem.WIDTH) + 0.5;
-        worm.pos_y = (my_rand(mem) % mem.HEIGHT) + 0.5;
-        worm.direction = my_rand(mem) % 360;
-		
-        int x = floor(worm.pos_x);
-        int y = floor(worm.pos_y);
-		
         if (x < 0 || mem.WIDTH <= x || y < 0 || mem.HEIGHT <= y ||
-            mem.board[x][y]) {
+            mem.board.get(x, y)) {
             mem.worms_alive--;
-            worm.eliminated = true;
+            eliminated = true;
             add_eliminated_event(mem, i);
 
             if (mem.worms_alive == 1) {
                 add_game_over_event(mem);
+                send_last_event_to_all_clients(mem);
 
                 return true;
             }
         }
         else {
-            mem.board[x][y] = true;
+            mem.board.set(x, y);
             add_pixel_event(mem, i, x, y);
         }
-        
-        mem.worms.push_back(worm);
+
+        mem.worms.push_back(pos_x, pos_y, direction, turn_direction, eliminated, bot);
     }
 
     timeval tv {};
@@ -394,9 +690,17 @@ bool initialize_game(memory_server_t &mem) {
     return false;
 }
 
+// Returns player's name from message. Name doesn't have to be null terminated
+// if it has maximal length.
+string get_player_name(client_mess_t &mess) {
+    const char *name = reinterpret_cast<char*>(mess.player_name);
+    return string(name, strnlen(name, PLAYER_NAME_LENGTH));
+}
+
 // Checks whether given message should be ignored.
 bool is_ignored(memory_server_t &mem, client_mess_t &mess, string &id) {
-    string name = reinterpret_cast<char*>(mess.player_name);
+    const char *name_ptr = reinterpret_cast<char*>(mess.player_name);
+    string_view name(name_ptr, strnlen(name_ptr, PLAYER_NAME_LENGTH));
 
     if (mess.turn_direction > LEFT) {
         return true;
@@ -408,17 +712,37 @@ bool is_ignored(memory_server_t &mem, client_mess_t &mess, string &id) {
         }
     }
 
-    if (mem.players.find(id) != mem.players.end()) {
-        return (mem.players[id].session_id < mess.session_id || mem.players[id].name != name);
+    auto it = mem.players.find(id);
+    if (it != mem.players.end()) {
+        return (it->second.session_id < mess.session_id || it->second.name != name);
     }
     else {
         return (mem.players.size() > MAX_PLAYERS);
     }
 }
 
+// Adds player to (or with sign -1 removes him from) counts of named and ready players.
+void count_player(memory_server_t &mem, player_t &player, int sign) {
+    mem.named_players += sign * !player.name.empty();
+    mem.ready_players += sign * player.ready;
+}
+
+// Counts named and ready players anew, after players were restored.
+void count_players(memory_server_t &mem) {
+    mem.named_players = 0;
+    mem.ready_players = 0;
+
+    for (auto &it : mem.players) {
+        count_player(mem, it.second, 1);
+    }
+}
+
 // Erases player from memory and frees his timer.
 void disconnect_player(memory_server_t &mem, string &id) {
-    mem.used_timers[mem.players[id].timer_num] = false;
+    player_t &player = mem.players[id];
+
+    count_player(mem, player, -1);
+    mem.used_timers[player.timer_num] = false;
     mem.players.erase(id);
 }
 
@@ -438,10 +762,9 @@ void disconnect_timeout(memory_server_t &mem) {
             }
 
             mem.timers[timer_num].revents = 0;
-            string id = it->first;
-			
-			it++;
-            disconnect_player(mem, id);
+            mem.used_timers[timer_num] = false;
+            count_player(mem, it->second, -1);
+            it = mem.players.erase(it);
             continue;
         }
         
@@ -449,97 +772,374 @@ void disconnect_timeout(memory_server_t &mem) {
     }
 }
 
+// Takes unused timer and arms it with player's timeout. Returns its number.
+int arm_free_timer(memory_server_t &mem) {
+    for (uint32_t i = 1; i < TIMERS_AMOUNT; i++) {
+        if (!mem.used_timers[i]) {
+            mem.used_timers[i] = true;
+            mem.timers[i].revents = 0;
+            timerfd_settime(mem.timers[i].fd, 0, &mem.player_timeout, nullptr);
+            return i;
+        }
+    }
+
+    return -1;
+}
+
 // Disconnects client if necessary, afterwards checks if he is good enough to be connected.
+// Connecting a new client allocates, so it's not counted as part of the hot path.
 void add_client(memory_server_t &mem, string &id, client_mess_t &mess, sockaddr_in6 &client_addr) {
     if (mem.players.find(id) != mem.players.end() && mem.players[id].session_id < mess.session_id) {
         disconnect_player(mem, id);
     }
 
     if (mem.players.find(id) == mem.players.end()) {
+        int hot_path = hot_path_state();
+        set_hot_path_state(HOT_PATH_OFF);
+
         player_t new_player {};
         new_player.session_id = mess.session_id;
         new_player.turn_direction = mess.turn_direction;
-        new_player.name = reinterpret_cast<char*>(mess.player_name);
+        new_player.name = get_player_name(mess);
         new_player.addr = client_addr;
-
-        for (uint32_t i = 1; i < TIMERS_AMOUNT; i++) {
-            if (!mem.used_timers[i]) {
-                new_player.timer_num = i;
-                mem.used_timers[i] = true;
-                mem.timers[i].revents = 0;
-                timerfd_settime(mem.timers[i].fd, 0, &mem.player_timeout, nullptr);
-                break;
-            }
-        }
+        new_player.timer_num = arm_free_timer(mem);
         
         mem.players[id] = new_player;
+        count_player(mem, new_player, 1);
+        set_hot_path_state(hot_path);
     }
 }
 
-// Reads message from client. Makes proper action if it's not ignored.
-// Resets client's timer.
-bool read_from_client(memory_server_t &mem) {
-    client_mess_t mess {};
-    sockaddr_in6 client_addr {};
-   	int mess_len;
-    socklen_t addr_len = sizeof(client_addr);
+// Returns time (in microseconds) until which server may wait for messages:
+// the next turn during the game, a short while otherwise.
+uint64_t wait_deadline(memory_server_t &mem) {
+    if (mem.worms_alive > 1) {
+        return mem.next_message;
+    }
+
+    timeval tv {};
+    gettimeofday(&tv, nullptr);
+    return tv.tv_sec * 1000000 + tv.tv_usec + IDLE_WAIT;
+}
+
+// Goes back to plain socket calls once the ring can't receive.
+void stop_uring(memory_server_t &mem) {
+    cout<<"io_uring receive failed, using sockets"<<endl;
+    uring_close(*mem.uring);
+    mem.uring.reset();
+}
+
+// Receives one datagram through io_uring into buff (TRACE_MAX_PAYLOAD bytes).
+// Waits for it (or for the next turn) if there is none.
+int uring_receive_client_mess(memory_server_t &mem, client_input_t &input, uint8_t *buff) {
+    int mess_len = uring_receive(*mem.uring, buff, TRACE_MAX_PAYLOAD, input.addr, input.received);
+
+    if (mess_len < 0 && !mem.uring->broken) {
+        uring_wait(*mem.uring, wait_deadline(mem));
+        mess_len = uring_receive(*mem.uring, buff, TRACE_MAX_PAYLOAD, input.addr, input.received);
+    }
+
+    return mess_len;
+}
+
+// Receives datagram from plain socket into buff (TRACE_MAX_PAYLOAD bytes)
+// like recvfrom, taking also the kernel's receive time if timestamps are on.
+int socket_receive(memory_server_t &mem, client_input_t &input, uint8_t *buff, int flags) {
+    alignas(cmsghdr) uint8_t control[CMSG_SPACE(sizeof(timespec))];
+    iovec iov {buff, TRACE_MAX_PAYLOAD};
+    msghdr msg {};
+
+    msg.msg_name = &input.addr;
+    msg.msg_namelen = sizeof(input.addr);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if (mem.LATENCY) {
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+    }
+
+    int mess_len = recvmsg(mem.sock, &msg, flags);
+    input.received = (mess_len >= 0 && mem.LATENCY) ? receive_timestamp(msg) : 0;
+
+    return mess_len;
+}
+
+// Receives message from plain socket. With precise wait the socket is
+// polled until the deadline (timeout of ppoll is exact, unlike the receive
+// timeout of the socket, which is rounded up to scheduler ticks).
+int socket_receive_client_mess(memory_server_t &mem, client_input_t &input, uint8_t *buff) {
+    if (!mem.PRECISE_WAIT) {
+        return socket_receive(mem, input, buff, MSG_TRUNC);
+    }
+
+    int mess_len = socket_receive(mem, input, buff, MSG_TRUNC | MSG_DONTWAIT);
+
+    if (mess_len < 0) {
+        timeval tv {};
+        gettimeofday(&tv, nullptr);
+        uint64_t now = tv.tv_sec * 1000000 + tv.tv_usec;
+        uint64_t deadline = max(wait_deadline(mem), now);
+
+        timespec timeout {};
+        timeout.tv_sec = (deadline - now) / 1000000;
+        timeout.tv_nsec = (deadline - now) % 1000000 * 1000;
+        pollfd fd {mem.sock, POLLIN, 0};
+
+        if (ppoll(&fd, 1, &timeout, nullptr) > 0) {
+            mess_len = socket_receive(mem, input, buff, MSG_TRUNC | MSG_DONTWAIT);
+        }
+    }
+
+    return mess_len;
+}
+
+// Opens the trace file if capture was asked for.
+void start_capture(memory_server_t &mem) {
+    if (mem.CAPTURE_PATH.empty()) {
+        return;
+    }
+
+    mem.capture = fopen(mem.CAPTURE_PATH.c_str(), "wb");
+
+    if (mem.capture == nullptr || setvbuf(mem.capture, nullptr, _IOFBF, TRACE_BUFFER) != 0) {
+        cout<<"capture file"<<endl;
+        exit(1);
+    }
+
+    timeval tv {};
+    gettimeofday(&tv, nullptr);
+
+    trace_header_t header {TRACE_MAGIC, TRACE_VERSION, static_cast<uint64_t>(tv.tv_sec) * 1000000 + tv.tv_usec};
+    fwrite(&header, sizeof(header), 1, mem.capture);
+    fflush(mem.capture);
+
+    mem.capture_start = monotonic_time();
+    mem.capture_flushed = mem.capture_start;
+}
+
+// Appends received datagram to the trace with its first TRACE_MAX_PAYLOAD
+// bytes (as far as they were received, the rest is zeros). The trace is
+// buffered and flushed about once per TRACE_FLUSH_SPAN and when the server
+// stops, so a crash loses only the last moments.
+void capture_datagram(memory_server_t &mem, client_input_t &input, uint8_t *buff, int mess_len) {
+    uint64_t now = monotonic_time();
+    trace_record_t record {};
+
+    record.time = now - mem.capture_start;
+    memcpy(record.addr, input.addr.sin6_addr.s6_addr, sizeof(record.addr));
+    record.port = ntohs(input.addr.sin6_port);
+    record.len = min(mess_len, UINT16_MAX);
+
+    fwrite(&record, sizeof(record), 1, mem.capture);
+    fwrite(buff, min<size_t>(mess_len, TRACE_MAX_PAYLOAD), 1, mem.capture);
+
+    if (now - mem.capture_flushed >= TRACE_FLUSH_SPAN) {
+        fflush(mem.capture);
+        mem.capture_flushed = now;
+    }
+}
+
+// Receives one message from client and converts it to host order.
+// Message with padding byte present may ask for bigger datagrams
+// and with flags after it for compressed catch-up.
+// Every datagram is captured if asked to. Then sources over their rate
+// limit are shed before anything else is done.
+// Returns -1 if there was nothing to read, 0 if message has incorrect size
+// or was shed and 1 otherwise.
+int receive_client_mess(memory_server_t &mem, client_input_t &input) {
+    static_assert(TRACE_MAX_PAYLOAD >= sizeof(client_mess_t), "trace payload");
+    uint8_t buff[TRACE_MAX_PAYLOAD] {};
+    int mess_len;
+
+    if (mem.uring) {
+        mess_len = uring_receive_client_mess(mem, input, buff);
+
+        if (mem.uring->broken) {
+            stop_uring(mem);
+        }
+    }
+    else {
+        mess_len = socket_receive_client_mess(mem, input, buff);
+    }
 
-    memset(&mess, 0, sizeof(client_mess_t));
-    mess_len = recvfrom(mem.sock, &mess, sizeof(client_mess_t), 0, (sockaddr*) &client_addr, &addr_len);
-    
     if (mess_len <= 0) {
-        return false;
+        return -1;
     }
-	
-	uint64_t tmp = mess_len;
-	if (tmp > CLIENT_MESS_SIZE || tmp < CLIENT_MESS_SIZE - PLAYER_NAME_LENGTH) {
-		return true;
-	}
-	
-	mess.session_id = be64toh(mess.session_id);
-	mess.next_expected_event_no = be32toh(mess.next_expected_event_no);
-    string id = get_player_id(client_addr);
-	
+
+    if (mem.capture != nullptr) {
+        capture_datagram(mem, input, buff, mess_len);
+    }
+
+    memcpy(&input.mess, buff, sizeof(client_mess_t));
+
+    if (mem.ADDRESS_RATE || mem.SUBNET_RATE) {
+        int shed = mem.limiter.check(input.addr, monotonic_time());
+
+        if (shed == RATE_ADDRESS_SHED) {
+            mem.metrics.shed_address.fetch_add(1, memory_order_relaxed);
+            return 0;
+        }
+        else if (shed == RATE_SUBNET_SHED) {
+            mem.metrics.shed_subnet.fetch_add(1, memory_order_relaxed);
+            return 0;
+        }
+    }
+
+    uint64_t tmp = mess_len;
+    if (tmp > sizeof(client_mess_t) || tmp < CLIENT_MESS_SIZE - PLAYER_NAME_LENGTH) {
+        return 0;
+    }
+
+    input.datagram_size = MAX_UDP;
+    if (tmp >= CLIENT_MESS_PADDED && input.mess.padding != 0) {
+        input.datagram_size = max<uint32_t>(MAX_UDP, input.mess.padding * DATAGRAM_UNIT);
+    }
+
+    input.compression = tmp == sizeof(client_mess_t) && (input.mess.flags & CLIENT_COMPRESSION);
+
+    input.mess.session_id = be64toh(input.mess.session_id);
+    input.mess.next_expected_event_no = be32toh(input.mess.next_expected_event_no);
+    return 1;
+}
+
+// Makes proper action for message from client if it's not ignored. Resets client's
+// timer. Local clients read events from shared memory, so they aren't sent any.
+void handle_client_input(memory_server_t &mem, client_input_t &input, bool local) {
+    latency_sample_t latency {input.received, input.received ? realtime_ns() : 0};
+    client_mess_t &mess = input.mess;
+    sockaddr_in6 &client_addr = input.addr;
+    string &id = mem.client_id;
+    get_player_id(client_addr, id);
+
     if (!is_ignored(mem, mess, id)) {
         add_client(mem, id, mess, client_addr);
         player_t *player = &mem.players[id];
         player->turn_direction = mess.turn_direction;
-        send_events_to_client(mem, mess.next_expected_event_no, client_addr);
+        player->datagram_size = min(input.datagram_size, mem.DATAGRAM_SIZE);
+        player->compression = input.compression;
+        player->local = local;
         timerfd_settime(mem.timers[player->timer_num].fd, 0, &mem.player_timeout, nullptr);
-		
-        if (player->worm_num >= 0) {
-            mem.worms[player->worm_num].turn_direction = mess.turn_direction;
+
+        if (!local) {
+            send_events_to_client(mem, mess.next_expected_event_no, *player, latency);
+        }
+
+        if (player->worm_num >= 0 && static_cast<size_t>(player->worm_num) < mem.worms.size()) {
+            mem.worms.turn_direction[player->worm_num] = mess.turn_direction;
         }
 
-        if (mess.turn_direction != 0 && mess.player_name[0] != '\0') {
+        if (mess.turn_direction != 0 && mess.player_name[0] != '\0' && !player->ready) {
             player->ready = true;
+            mem.ready_players++;
         }
     }
-    
-    return true;
 }
 
-// Checks whether conditions for starting the game are fulfiled.
-bool check_for_game_start(memory_server_t &mem) {
-    int cnt = 0;
+// Reads message from client (from socket or, in pipelined mode, from receive thread)
+// and handles it.
+bool read_from_client(memory_server_t &mem) {
+    client_input_t input {};
 
-    for (auto &player : mem.players) {
-        if (player.second.ready) {
-            cnt++;
+    if (mem.PIPELINED) {
+        if (!mem.pipeline->inputs.pop(input)) {
+            usleep(RCV_WAIT);
+            return false;
         }
-        else if (!player.second.name.empty()) {
+    }
+    else {
+        int res = receive_client_mess(mem, input);
+
+        if (res < 0) {
             return false;
         }
+        else if (res == 0) {
+            return true;
+        }
+    }
+
+    handle_client_input(mem, input, false);
+    return true;
+}
+
+// Receive thread of pipelined mode. Passes correct messages to simulation thread.
+// Messages are dropped if simulation thread can't keep up.
+void receive_loop(memory_server_t &mem) {
+    client_input_t input {};
+
+    while (true) {
+        if (receive_client_mess(mem, input) > 0) {
+            mem.pipeline->inputs.push(std::move(input));
+        }
+    }
+}
+
+// Send thread of pipelined mode. Keeps its own copy of current game's events
+// and performs all sending to clients.
+void send_loop(memory_server_t &mem) {
+    pipeline_t &pipeline = *mem.pipeline;
+    send_task_t task {};
+
+    while (true) {
+        if (!pipeline.tasks.pop(task)) {
+            usleep(RCV_WAIT);
+            continue;
+        }
+
+        if (task.type == TASK_NEW_LOG) {
+            pipeline.game_id = task.game_id;
+            pipeline.events.clear();
+        }
+        else if (task.type == TASK_EVENT) {
+            memcpy(pipeline.events.append(task.event_size), task.event, task.event_size);
+        }
+        else {
+            int syscalls = send_events(mem, pipeline.game_id, pipeline.events, task.from_event_no,
+                                       task.addrs, task.datagram_sizes, task.addr_cnt, task.compression);
+
+            if (task.type == TASK_BROADCAST) {
+                mem.metrics.broadcast_syscalls += syscalls;
+                record_live_latencies(mem, task);
+            }
+            else {
+                mem.metrics.catch_up_syscalls += syscalls;
+            }
+
+            if (task.type == TASK_CATCH_UP) {
+                mem.metrics.latency.record(LATENCY_CATCH_UP, task.latency,
+                                           task.latency.received ? realtime_ns() : 0);
+            }
+        }
     }
+}
+
+// Starts receive and send threads. Main thread becomes the simulation thread
+// and remains the only owner of game state, so the game stays deterministic.
+void start_pipeline(memory_server_t &mem) {
+    mem.pipeline = make_unique<pipeline_t>();
+    mem.pipeline->receiver = thread(receive_loop, ref(mem));
+    mem.pipeline->sender = thread(send_loop, ref(mem));
+}
 
-    return (cnt >= 2);
+// Checks whether conditions for starting the game are fulfiled: every
+// named player is ready. Ready players are always named.
+bool check_for_game_start(memory_server_t &mem) {
+    int cnt = mem.ready_players;
+
+    return (cnt == mem.named_players && cnt >= 1 && cnt + mem.BOTS >= 2);
 }
 
 // Waits for proper conditions to start the game and performs
-// reading from players and disscontcting as well.
+// reading from players and disscontcting as well. The next game
+// is prepared first, while its players are still awaited.
 bool start_game(memory_server_t &mem) {
+    prepare_next_game(mem);
+
     while (true) {
+        checkpoint_if_due(mem);
         disconnect_timeout(mem);
+        read_mailboxes(mem);
+        serve_spectators(mem);
 
         if (check_for_game_start(mem)) {
             break;
@@ -555,6 +1155,108 @@ bool start_game(memory_server_t &mem) {
     return initialize_game(mem);
 }
 
+// Notes how late (in microseconds) the tick started.
+void record_lateness(memory_server_t &mem, uint64_t lateness) {
+    metrics_t &metrics = mem.metrics;
+
+    metrics.lateness_sum += lateness;
+    metrics.lateness_max = max(metrics.lateness_max, lateness);
+    metrics.lateness[min<uint64_t>(lateness / LATENESS_BUCKET_US, LATENESS_BUCKETS - 1)]++;
+}
+
+// Returns upper bound of the bucket in which given fraction of ticks started.
+uint64_t lateness_percentile(metrics_t &metrics, double fraction) {
+    uint64_t wanted = ceil(metrics.ticks * fraction);
+    uint64_t cnt = 0;
+
+    for (int i = 0; i < LATENESS_BUCKETS - 1; i++) {
+        cnt += metrics.lateness[i];
+
+        if (cnt >= wanted) {
+            return min<uint64_t>((i + 1) * LATENESS_BUCKET_US, metrics.lateness_max);
+        }
+    }
+
+    return metrics.lateness_max;
+}
+
+// Prints histograms of latency of answering clients' messages gathered
+// during the last game and resets them. Buckets are given by their lower
+// bounds in microseconds, empty ones are left out.
+void report_latency(memory_server_t &mem) {
+    static const char *kinds[LATENCY_KINDS] = {"live", "catch-up"};
+    static const char *stages[LATENCY_STAGES] = {"socket", "loop", "total"};
+
+    for (int kind = 0; kind < LATENCY_KINDS; kind++) {
+        for (int stage = 0; stage < LATENCY_STAGES; stage++) {
+            latency_histogram_t &histogram = mem.metrics.latency.histograms[kind][stage];
+            uint64_t cnt = histogram.count.exchange(0);
+            uint64_t sum = histogram.sum.exchange(0);
+            uint64_t max = histogram.max.exchange(0);
+
+            cout<<"game "<<mem.game_id<<" latency "<<kinds[kind]<<" "<<stages[stage]<<": messages "<<cnt;
+
+            if (cnt > 0) {
+                cout<<", mean "<<sum / cnt / 1000.0<<" us, max "<<max / 1000.0<<" us, histogram";
+            }
+
+            for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+                uint64_t bucket = histogram.buckets[i].exchange(0);
+
+                if (bucket > 0) {
+                    cout<<" "<<latency_histogram_t::lower_bound(i) / 1000.0<<":"<<bucket;
+                }
+            }
+
+            cout<<endl;
+        }
+    }
+}
+
+// Prints metrics gathered during the last game and resets them.
+void report_metrics(memory_server_t &mem) {
+    metrics_t &metrics = mem.metrics;
+    uint64_t broadcast_syscalls = metrics.broadcast_syscalls.exchange(0);
+    uint64_t catch_up_syscalls = metrics.catch_up_syscalls.exchange(0);
+    uint64_t shed_address = metrics.shed_address.exchange(0);
+    uint64_t shed_subnet = metrics.shed_subnet.exchange(0);
+    uint64_t compressed_raw = metrics.compressed_raw.exchange(0);
+    uint64_t compressed_sent = metrics.compressed_sent.exchange(0);
+    uint64_t allocations = take_hot_path_allocations();
+
+    if (mem.METRICS && metrics.ticks > 0) {
+        cout<<"game "<<mem.game_id<<": ticks "<<metrics.ticks
+            <<", send syscalls per tick "<<static_cast<double>(broadcast_syscalls) / metrics.ticks<<" (broadcast) "
+            <<static_cast<double>(catch_up_syscalls) / metrics.ticks<<" (catch-up)"
+            <<", board tiles "<<mem.board.allocated_tiles()
+            <<", tick lateness mean "<<metrics.lateness_sum / metrics.ticks
+            <<" us, p99 "<<lateness_percentile(metrics, 0.99)
+            <<" us, max "<<metrics.lateness_max<<" us"
+            <<", shed messages "<<shed_address<<" (address) "<<shed_subnet<<" (subnet)"
+            <<", shed catch-ups "<<metrics.shed_catch_ups
+            <<", compressed catch-up "<<compressed_raw<<" -> "<<compressed_sent<<" bytes"
+            <<", spectators "<<mem.spectators.fds.size() - (mem.spectators.listener >= 0)
+            <<" (connected "<<mem.spectators.connected<<") sent "<<mem.spectators.bytes<<" bytes"
+#ifdef SK_COUNT_ALLOCATIONS
+            <<", allocations per tick "<<static_cast<double>(allocations) / metrics.ticks
+#endif
+            <<endl;
+    }
+    (void) allocations;
+
+    if (mem.METRICS && mem.LATENCY) {
+        report_latency(mem);
+    }
+
+    mem.spectators.connected = 0;
+    mem.spectators.bytes = 0;
+    metrics.shed_catch_ups = 0;
+    metrics.ticks = 0;
+    metrics.lateness_sum = 0;
+    metrics.lateness_max = 0;
+    memset(metrics.lateness, 0, sizeof(metrics.lateness));
+}
+
 // Main structure of one game.
 void make_turns(memory_server_t &mem) {
 	timeval tv {};
@@ -564,25 +1266,127 @@ void make_turns(memory_server_t &mem) {
         uint64_t t = tv.tv_sec * 1000000 + tv.tv_usec;
 
         while (mem.next_message <= t) {
+            record_lateness(mem, t - mem.next_message);
             mem.next_message += mem.turn_span.it_value.tv_nsec / 1000;
-            
-            if (make_moves(mem)) {
-	            return;
-	        }
+            mem.metrics.ticks++;
+
+            set_hot_path_state(mem.warmed_up ? HOT_PATH_STRICT : HOT_PATH_COUNTED);
+            bool game_over = make_moves(mem);
+            set_hot_path_state(HOT_PATH_OFF);
+
+            if (game_over) {
+                mem.warmed_up = true;
+                report_metrics(mem);
+                return;
+            }
         }
 
+        checkpoint_if_due(mem);
+        set_hot_path_state(mem.warmed_up ? HOT_PATH_STRICT : HOT_PATH_COUNTED);
         disconnect_timeout(mem);
+        read_mailboxes(mem);
         
         for (uint32_t i = 0; i < CLIENTS_AT_ONCE; i++) {
         	if (!read_from_client(mem)) {
         		break;
         	}
         }
+        set_hot_path_state(HOT_PATH_OFF);
+        serve_spectators(mem);
+    }
+}
+
+// Switches server's socket to io_uring. Falls back to plain
+// socket calls if io_uring is not available.
+void start_uring(memory_server_t &mem) {
+    mem.uring = make_unique<uring_t>();
+
+    if (!uring_init(*mem.uring, mem.sock)) {
+        cout<<"io_uring not available, using sockets"<<endl;
+        mem.uring.reset();
     }
 }
 
-// Main structure of program flow.
-void play(memory_server_t &mem) {
+// Reserves the event log for the biggest possible game (every pixel painted,
+// every worm eliminated) within the prefault limits, so appending events
+// during ticks doesn't reallocate.
+void reserve_event_log(memory_server_t &mem) {
+    uint64_t pixels = static_cast<uint64_t>(mem.WIDTH) * mem.HEIGHT;
+    uint64_t events = pixels + MAX_WORMS + 2;
+    uint64_t bytes = pixels * pixel_event::size + MAX_WORMS * eliminated_event::size +
+                     MAX_EVENT_SIZE + game_over_event::size;
+
+    mem.events.reserve_capacity(min<uint64_t>(bytes, PREFAULT_LOG_BYTES), min<uint64_t>(events, PREFAULT_LOG_EVENTS));
+}
+
+// Applies low jitter options. Pinning and priority concern only the calling
+// (simulation) thread, so it's called after other threads are started.
+// Memory is prefaulted before it's locked, so that the first game doesn't
+// page fault in the board and the event log.
+void setup_low_jitter(memory_server_t &mem) {
+    string applied;
+    mem.board.use_huge_pages(mem.HUGE_PAGES);
+
+    if (mem.LOCK_MEMORY || mem.HUGE_PAGES) {
+        clean_board(mem);
+        mem.board.reserve(PREFAULT_TILES);
+        mem.events.reserve(PREFAULT_LOG_BYTES, PREFAULT_LOG_EVENTS);
+
+        if (mem.HUGE_PAGES) {
+            advise_huge_pages(mem.events.data.data(), mem.events.data.capacity());
+            advise_huge_pages(mem.events.offsets.data(), mem.events.offsets.capacity() * sizeof(size_t));
+            applied += " huge pages,";
+        }
+    }
+
+    if (mem.LOCK_MEMORY) {
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) == 0) {
+            applied += " memory locked,";
+        }
+        else {
+            applied += " memory prefaulted (mlockall not permitted),";
+        }
+    }
+
+    if (mem.CPU != NO_CPU) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(mem.CPU, &cpus);
+
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+            cout<<"cpu pinning"<<endl;
+            exit(1);
+        }
+        applied += " cpu " + to_string(mem.CPU) + ",";
+    }
+
+    if (mem.FIFO_PRIORITY > 0) {
+        sched_param param {};
+        param.sched_priority = mem.FIFO_PRIORITY;
+
+        if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0) {
+            cout<<"SCHED_FIFO not permitted"<<endl;
+            exit(1);
+        }
+        applied += " SCHED_FIFO " + to_string(mem.FIFO_PRIORITY) + ",";
+    }
+
+    if (mem.PRECISE_WAIT) {
+        applied += " precise wait,";
+    }
+
+    if (!applied.empty()) {
+        applied.pop_back();
+        cout<<"low jitter:"<<applied<<endl;
+    }
+}
+
+// Main structure of program flow. Continues the game restored from checkpoint first.
+void play(memory_server_t &mem, bool restored_game) {
+    if (restored_game) {
+        make_turns(mem);
+    }
+
     while (true) {
         if (start_game(mem)) {
             continue;
@@ -592,12 +1396,28 @@ void play(memory_server_t &mem) {
     }
 }
 
+#ifndef SK_NO_MAIN
 int main(int argc, char *argv[]) {
     memory_server_t mem {};
     
     update_options(mem, argc, argv);
     create_socket(mem);
     set_timers(mem);
-    
-    play(mem);
+    start_shared_memory(mem);
+    start_capture(mem);
+    start_spectators(mem);
+
+    if (mem.PIPELINED) {
+        start_pipeline(mem);
+    }
+
+    if (mem.BACKEND == BACKEND_URING) {
+        start_uring(mem);
+    }
+
+    reserve_event_log(mem);
+    setup_low_jitter(mem);
+    install_checkpoint_signals(mem);
+    play(mem, restore_checkpoint(mem));
 }
+#endif
@@ -9,6 +9,21 @@
 #include <unistd.h>
 #include <poll.h>
 #include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "screen-worms-uring.h"
+#include "screen-worms-movement.h"
+#include "screen-worms-board.h"
+#include "screen-worms-events.h"
+#include "screen-worms-ratelimit.h"
+#include "screen-worms-allocs.h"
+#include "screen-worms-shm.h"
+#include "screen-worms-trace.h"
+#include "screen-worms-latency.h"
 
 using namespace std;
 
@@ -16,14 +31,67 @@ enum constants_server {
     TIMERS_AMOUNT = 26,
     TIMEOUT = 2,
     
-    MAX_WIDTH = 2000,
-    MAX_HEIGHT = 2000,
+    MAX_WIDTH = 65536,
+    MAX_HEIGHT = 65536,
     
     CLIENT_MESS_SIZE = 33,
     CLIENTS_AT_ONCE = 10,
+    BIND_ATTEMPTS = 100,
+    BIND_RETRY_WAIT = 10000,
     
     RAND_MULT = 279410273,
     RAND_MOD = 4294967291,
+
+    IDLE_WAIT = 10000,
+
+    BACKEND_SOCKETS = 0,
+    BACKEND_URING,
+
+    INPUT_QUEUE_SIZE = 4096,
+    SEND_QUEUE_SIZE = 4096,
+
+    NO_CPU = -1,
+    PREFAULT_TILES = 8192,
+    PREFAULT_LOG_BYTES = 1 << 24,
+    PREFAULT_LOG_EVENTS = 1 << 20,
+    LATENESS_BUCKETS = 1000,
+    LATENESS_BUCKET_US = 10,
+
+    MAX_EVENT_SIZE = new_game_event::size + MAX_PLAYERS * (PLAYER_NAME_LENGTH + 1),
+};
+
+// Single producer, single consumer lock-free ring buffer.
+// One slot is always left empty to tell full queue from empty one.
+template<typename T, size_t N>
+struct spsc_queue_t {
+    T slots[N];
+    alignas(64) atomic<size_t> head {0};
+    alignas(64) atomic<size_t> tail {0};
+
+    bool push(T &&item) {
+        size_t t = tail.load(memory_order_relaxed);
+        size_t next = (t + 1) % N;
+
+        if (next == head.load(memory_order_acquire)) {
+            return false;
+        }
+
+        slots[t] = std::move(item);
+        tail.store(next, memory_order_release);
+        return true;
+    }
+
+    bool pop(T &item) {
+        size_t h = head.load(memory_order_relaxed);
+
+        if (h == tail.load(memory_order_acquire)) {
+            return false;
+        }
+
+        item = std::move(slots[h]);
+        head.store((h + 1) % N, memory_order_release);
+        return true;
+    }
 };
 
 struct player_t {
@@ -36,15 +104,136 @@ struct player_t {
     int worm_num = -1;
 
     sockaddr_in6 addr {};
+    uint32_t datagram_size = MAX_UDP;
+    bool compression = false;
+    bool local = false;
+
+    // The first message answered by a coming broadcast. Its latency is noted
+    // when the broadcast carrying event live_event_no goes out.
+    latency_sample_t live_latency;
+    uint32_t live_event_no = 0;
+};
+
+// Decoded message from client together with its address.
+struct client_input_t {
+    client_mess_t mess {};
+    sockaddr_in6 addr {};
+    uint32_t datagram_size = MAX_UDP;
+    bool compression = false;
+    // Kernel's receive time if measured (see screen-worms-latency.h).
+    uint64_t received = 0;
 };
 
-struct worm_t {
-    double pos_x = 0;
-    double pos_y = 0;
-    int direction = 0;
-    uint8_t turn_direction = 0;
+enum send_task_type {
+    TASK_NEW_LOG,
+    TASK_EVENT,
+    TASK_CATCH_UP,
+    TASK_BROADCAST,
+};
+
+// Work order for the send thread. Events are copied into the send thread's
+// own event log, so it never touches memory owned by the simulation thread.
+// The copy is kept inside the task, so passing an event doesn't allocate.
+struct send_task_t {
+    send_task_type type = TASK_EVENT;
+    uint32_t game_id = 0;
+    uint32_t from_event_no = 0;
+    uint32_t event_size = 0;
+    uint8_t event[MAX_EVENT_SIZE];
+
+    int addr_cnt = 0;
+    sockaddr_in6 addrs[MAX_PLAYERS + 1] {};
+    uint32_t datagram_sizes[MAX_PLAYERS + 1] {};
+    bool compression = false;
+    latency_sample_t latency;
+    // Broadcast answers live messages of some of its addresses.
+    latency_sample_t live_latencies[MAX_PLAYERS + 1] {};
+};
+
+// State shared by receive, simulation and send threads in pipelined mode.
+struct pipeline_t {
+    spsc_queue_t<client_input_t, INPUT_QUEUE_SIZE> inputs;
+    spsc_queue_t<send_task_t, SEND_QUEUE_SIZE> tasks;
+
+    // Owned by the simulation thread.
+    size_t published_events = 0;
+
+    // Owned by the send thread.
+    uint32_t game_id = 0;
+    event_log_t events;
 
-    bool eliminated = false;
+    thread receiver;
+    thread sender;
+};
+
+// Thread writing periodic checkpoints, so the tick thread only encodes them.
+struct checkpoint_thread_t {
+    mutex lock;
+    condition_variable done;
+    condition_variable wake;
+    // Checkpoint handed over to the thread, untouched by the tick thread
+    // while busy.
+    vector<uint8_t> data;
+    // Encoded by the tick thread, swapped with data.
+    vector<uint8_t> spare;
+    bool busy = false;
+
+    thread writer;
+};
+
+// Counters reported at the end of each game.
+struct metrics_t {
+    uint64_t ticks = 0;
+    // Sending system calls, counted by the sending thread.
+    atomic<uint64_t> broadcast_syscalls {0};
+    atomic<uint64_t> catch_up_syscalls {0};
+
+    // Traffic shed by rate limits. Messages are counted by the receiving thread.
+    atomic<uint64_t> shed_address {0};
+    atomic<uint64_t> shed_subnet {0};
+    uint64_t shed_catch_ups = 0;
+
+    // Catch-up sent compressed: bytes of its events and of its datagrams.
+    // Counted by the sending thread.
+    atomic<uint64_t> compressed_raw {0};
+    atomic<uint64_t> compressed_sent {0};
+
+    // How late (in microseconds) ticks started, LATENESS_BUCKET_US wide
+    // buckets, the last one takes everything above.
+    uint64_t lateness_sum = 0;
+    uint64_t lateness_max = 0;
+    uint32_t lateness[LATENESS_BUCKETS] {};
+
+    latency_t latency;
+};
+
+// Work for the next game which doesn't depend on who plays in it, done
+// while waiting for the game to start (see prepare_next_game).
+struct next_game_t {
+    bool prepared = false;
+
+    // Bots' names with empty ids, sorted.
+    vector<pair<string, string>> bots;
+};
+
+// Spectators watching over TCP in gui's text protocol. Text of the current
+// game is rendered once, every spectator is at its own position in it.
+// The first pollfd is the listening socket, sent[i] and line_end[i] belong
+// to fds[i]. A spectator stopped in the middle of a line of the previous game
+// gets the rest of that line (line_end[i]) before the new game.
+struct spectators_t {
+    int listener = -1;
+    vector<pollfd> fds;
+    vector<size_t> sent;
+    vector<string> line_end;
+
+    uint32_t game_id = 0;
+    size_t rendered = 0;
+    string text;
+    vector<string> names;
+
+    uint64_t connected = 0;
+    uint64_t bytes = 0;
 };
 
 struct memory_server_t {
@@ -54,15 +243,48 @@ struct memory_server_t {
     int ROUNDS_PER_SEC = 50;
     int WIDTH = 640;
     int HEIGHT = 480;
+    int BOTS = 0;
+    int SIMD_LEVEL = detect_simd_level();
+    uint32_t DATAGRAM_SIZE = MAX_UDP;
+    int BACKEND = BACKEND_SOCKETS;
+    bool PIPELINED = false;
+    bool METRICS = false;
+    int CPU = NO_CPU;
+    bool LOCK_MEMORY = false;
+    bool HUGE_PAGES = false;
+    int FIFO_PRIORITY = 0;
+    bool PRECISE_WAIT = false;
+    string CHECKPOINT_PATH;
+    uint32_t CHECKPOINT_SPAN = 1000;
+    uint32_t ADDRESS_RATE = 0;
+    uint32_t SUBNET_RATE = 0;
+    uint32_t CATCH_UP_RATE = 0;
+    string SHM_NAME;
+    string CAPTURE_PATH;
+    bool LATENCY = false;
+    uint16_t SPECTATOR_PORT = 0;
 
-    bool board[MAX_WIDTH][MAX_HEIGHT] {};
+    board_t board;
     map<string, player_t> players;
-    vector<vector<uint8_t>> events;
-    vector<worm_t> worms;
+    event_log_t events;
+    worms_t worms;
     
     int worms_alive = -1;
     int last_event = 0;
+
+    // Players with a name and those of them ready to play, kept up to date
+    // as players come, go and press arrows.
+    int named_players = 0;
+    int ready_players = 0;
+    next_game_t next_game;
+
     uint32_t game_id = 0;
+    uint32_t rand_state = 0;
+    uint64_t next_checkpoint = 0;
+
+    // After the first game ticks must not allocate (see screen-worms-allocs.h).
+    bool warmed_up = false;
+    string client_id;
 
     sockaddr_in6 local_addr {};
     int sock = -1;
@@ -73,6 +295,45 @@ struct memory_server_t {
     bool used_timers[TIMERS_AMOUNT] {};
     itimerspec turn_span {};
     itimerspec player_timeout {};
+
+    rate_limiter_t limiter;
+    token_bucket_t catch_up_budget;
+    // Bytes of compressed catch-up sent above (or below) what was charged
+    // for it up front, added by the sending thread.
+    atomic<int64_t> catch_up_settlement {0};
+
+    // Trace of received datagrams (see screen-worms-trace.h).
+    FILE *capture = nullptr;
+    uint64_t capture_start = 0;
+    uint64_t capture_flushed = 0;
+
+    // Transport for local clients (see screen-worms-shm.h).
+    shm_t shm;
+    uint32_t shm_game_id = 0;
+    size_t shm_published = 0;
+    uint32_t mailbox_seq[SHM_MAILBOXES] {};
+
+    spectators_t spectators;
+
+    unique_ptr<pipeline_t> pipeline;
+    unique_ptr<uring_t> uring;
+    unique_ptr<checkpoint_thread_t> checkpoint_thread;
+    metrics_t metrics;
 };
 
+// Game logic, used also by benchmarks (built with SK_NO_MAIN).
+void clean_board(memory_server_t &mem);
+void calculate_crc(uint8_t *data, uint64_t len);
+string get_player_id(sockaddr_in6 &player_addr);
+void get_player_id(sockaddr_in6 &player_addr, string &id);
+bool is_ignored(memory_server_t &mem, client_mess_t &mess, string &id);
+int arm_free_timer(memory_server_t &mem);
+void count_players(memory_server_t &mem);
+void push_task(memory_server_t &mem, send_task_t &&task, bool wait);
+void handle_client_input(memory_server_t &mem, client_input_t &input, bool local);
+void add_pixel_event(memory_server_t &mem, uint8_t player, uint32_t x, uint32_t y);
+void add_eliminated_event(memory_server_t &mem, uint8_t player);
+bool make_moves(memory_server_t &mem);
+bool initialize_game(memory_server_t &mem);
+
 #endif
@@ -0,0 +1,112 @@
+#ifndef SK_SCREEN_WORMS_SHM_H
+#define SK_SCREEN_WORMS_SHM_H
+
+#include <atomic>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common.h"
+
+// Shared memory through which processes on the server's host play without
+// UDP. The server writes every event once into a ring which local clients
+// read on their own, and takes their messages from mailboxes.
+enum constants_shm {
+    SHM_MAGIC = 0x534b5753,
+    SHM_VERSION = 1,
+
+    SHM_RING_EVENTS = 1 << 21,
+    SHM_RING_BYTES = 1 << 25,
+    SHM_MAILBOXES = 64,
+
+    // Bigger than any event. An event being written lies less than
+    // two of these past head_bytes.
+    SHM_MAX_EVENT = 1024,
+};
+
+// Place of one event in the ring of bytes, with id of its game.
+struct shm_event_t {
+    uint64_t pos;
+    uint32_t game_id;
+    uint32_t size;
+};
+
+// Latest message of one local client. The client takes a free mailbox by
+// writing its pid to owner; a mailbox of a process which no longer exists
+// is free as well. seq is odd while the message is being written.
+struct alignas(64) shm_mailbox_t {
+    std::atomic<int32_t> owner;
+    std::atomic<uint32_t> seq;
+    client_mess_t mess;
+};
+
+// Events are numbered from the start of the server, the i-th one is described
+// by entry i % SHM_RING_EVENTS and its bytes start at pos % SHM_RING_BYTES
+// (an event never wraps around the end of the ring). Only the last
+// SHM_RING_EVENTS events are kept, within SHM_RING_BYTES bytes.
+// head_events and head_bytes are published after the event is written,
+// game_first is the number of the first event of the current game.
+struct shm_header_t {
+    uint32_t magic;
+    uint32_t version;
+
+    alignas(64) std::atomic<uint64_t> head_events;
+    std::atomic<uint64_t> head_bytes;
+    std::atomic<uint64_t> game_first;
+
+    shm_mailbox_t mailboxes[SHM_MAILBOXES];
+};
+
+struct shm_t {
+    shm_header_t *header = nullptr;
+    shm_event_t *entries = nullptr;
+    uint8_t *bytes = nullptr;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared atomics must be lock free");
+
+const size_t SHM_SIZE = sizeof(shm_header_t) + SHM_RING_EVENTS * sizeof(shm_event_t) + SHM_RING_BYTES;
+
+// Maps shared memory of given name, creating it anew if asked to.
+// Returns false if it can't be mapped or isn't the server's ring.
+inline bool map_shm(shm_t &shm, const char *name, bool create) {
+    int fd;
+
+    if (create) {
+        shm_unlink(name);
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+
+        if (fd < 0 || ftruncate(fd, SHM_SIZE) < 0) {
+            return false;
+        }
+    }
+    else {
+        fd = shm_open(name, O_RDWR, 0);
+
+        if (fd < 0) {
+            return false;
+        }
+    }
+
+    void *ptr = mmap(nullptr, SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (ptr == MAP_FAILED) {
+        return false;
+    }
+
+    shm.header = static_cast<shm_header_t*>(ptr);
+    shm.entries = reinterpret_cast<shm_event_t*>(static_cast<uint8_t*>(ptr) + sizeof(shm_header_t));
+    shm.bytes = reinterpret_cast<uint8_t*>(shm.entries + SHM_RING_EVENTS);
+
+    if (create) {
+        shm.header->magic = SHM_MAGIC;
+        shm.header->version = SHM_VERSION;
+    }
+
+    return shm.header->magic == SHM_MAGIC && shm.header->version == SHM_VERSION;
+}
+
+#endif
@@ -0,0 +1,212 @@
+#include "screen-worms-spectators.h"
+
+#include <charconv>
+
+void start_spectators(memory_server_t &mem) {
+    if (mem.SPECTATOR_PORT == 0) {
+        return;
+    }
+
+    spectators_t &spect = mem.spectators;
+    spect.listener = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK, 0);
+
+    int reuse = 1;
+    int v6OnlyEnabled = 0;
+    if (spect.listener < 0 ||
+        setsockopt(spect.listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0 ||
+        setsockopt(spect.listener, IPPROTO_IPV6, IPV6_V6ONLY, &v6OnlyEnabled, sizeof(v6OnlyEnabled)) != 0) {
+        cout<<"spectator socket"<<endl;
+        exit(1);
+    }
+
+    sockaddr_in6 addr {};
+    addr.sin6_family = AF_INET6;
+    addr.sin6_addr = in6addr_any;
+    addr.sin6_port = htons(mem.SPECTATOR_PORT);
+
+    if (bind(spect.listener, (sockaddr*) &addr, sizeof(addr)) < 0 || listen(spect.listener, SPECTATORS_BACKLOG) < 0) {
+        cout<<"spectator bind"<<endl;
+        exit(1);
+    }
+
+    spect.fds.push_back({spect.listener, POLLIN, 0});
+    spect.sent.push_back(0);
+    spect.line_end.emplace_back();
+}
+
+// Appends number in decimal to text.
+static void append_number(string &text, uint32_t value) {
+    char buff[16];
+    char *end = to_chars(buff, buff + sizeof(buff), value).ptr;
+    text.append(buff, end);
+}
+
+// Appends gui's line of one event from the log. Names of players
+// are taken from the NEW_GAME event. GAME_OVER has no line.
+static void render_event(spectators_t &spect, const uint8_t *event) {
+    uint64_t offset = 0;
+    auto [len] = event_len_layout::decode(event, offset);
+    auto [event_no, event_type] = event_head_layout::decode(event, offset);
+    (void) event_no;
+
+    if (event_type == NEW_GAME_TYPE) {
+        auto [max_x, max_y] = new_game_layout::decode(event, offset);
+        uint64_t end = event_len_layout::size + len;
+
+        spect.names.clear();
+        spect.text += "NEW_GAME ";
+        append_number(spect.text, max_x);
+        spect.text += ' ';
+        append_number(spect.text, max_y);
+
+        while (offset < end) {
+            const char *name = reinterpret_cast<const char*>(event + offset);
+            spect.names.emplace_back(name);
+            spect.text += ' ';
+            spect.text += spect.names.back();
+            offset += spect.names.back().size() + 1;
+        }
+        spect.text += '\n';
+    }
+    else if (event_type == PIXEL_TYPE) {
+        auto [player, x, y] = pixel_layout::decode(event, offset);
+
+        spect.text += "PIXEL ";
+        append_number(spect.text, x);
+        spect.text += ' ';
+        append_number(spect.text, y);
+        spect.text += ' ';
+        spect.text += spect.names[player];
+        spect.text += '\n';
+    }
+    else if (event_type == ELIMINATED_TYPE) {
+        auto [player] = eliminated_layout::decode(event, offset);
+
+        spect.text += "PLAYER_ELIMINATED ";
+        spect.text += spect.names[player];
+        spect.text += '\n';
+    }
+}
+
+// Text starts anew with a new game, spectators then get it from the beginning
+// once they finish the line they are in.
+static void render_events(memory_server_t &mem) {
+    spectators_t &spect = mem.spectators;
+
+    if (spect.game_id != mem.game_id || spect.rendered > mem.events.size()) {
+        for (size_t i = 1; i < spect.fds.size(); i++) {
+            size_t sent = spect.sent[i];
+
+            if (sent > 0 && sent < spect.text.size() && spect.text[sent - 1] != '\n') {
+                spect.line_end[i] += spect.text.substr(sent, spect.text.find('\n', sent) + 1 - sent);
+            }
+            spect.sent[i] = 0;
+        }
+
+        spect.game_id = mem.game_id;
+        spect.rendered = 0;
+        spect.text.clear();
+    }
+
+    for (; spect.rendered < mem.events.size(); spect.rendered++) {
+        render_event(spect, mem.events.event(spect.rendered));
+    }
+}
+
+static void remove_spectator(spectators_t &spect, size_t i) {
+    close(spect.fds[i].fd);
+    spect.fds[i] = spect.fds.back();
+    spect.sent[i] = spect.sent.back();
+    spect.line_end[i] = std::move(spect.line_end.back());
+    spect.fds.pop_back();
+    spect.sent.pop_back();
+    spect.line_end.pop_back();
+}
+
+// Spectator starts with the whole text of the current game.
+static void accept_spectators(spectators_t &spect) {
+    while (true) {
+        int sock = accept4(spect.listener, nullptr, nullptr, SOCK_NONBLOCK);
+
+        if (sock < 0) {
+            return;
+        }
+
+        spect.fds.push_back({sock, POLLIN, 0});
+        spect.sent.push_back(0);
+        spect.line_end.emplace_back();
+        spect.connected++;
+    }
+}
+
+// Keys pressed in spectator's gui are ignored. Spectator is removed
+// when its gui closes the connection.
+static bool drain_spectator(spectators_t &spect, size_t i) {
+    char buff[SPECTATOR_READ];
+    ssize_t len;
+
+    while ((len = read(spect.fds[i].fd, buff, sizeof(buff))) > 0) {
+    }
+
+    return len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+// Sends what fits in the socket. Returns false if the connection is broken.
+static bool flush_spectator(spectators_t &spect, size_t i) {
+    string &line_end = spect.line_end[i];
+
+    while (!line_end.empty()) {
+        ssize_t len = send(spect.fds[i].fd, line_end.data(), line_end.size(), MSG_NOSIGNAL);
+
+        if (len < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+
+        line_end.erase(0, len);
+        spect.bytes += len;
+    }
+
+    while (spect.sent[i] < spect.text.size()) {
+        ssize_t len = send(spect.fds[i].fd, spect.text.data() + spect.sent[i],
+                           spect.text.size() - spect.sent[i], MSG_NOSIGNAL);
+
+        if (len < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+
+        spect.sent[i] += len;
+        spect.bytes += len;
+    }
+
+    return true;
+}
+
+// All sockets are polled with one system call, new text is written only
+// to spectators which are behind.
+void serve_spectators(memory_server_t &mem) {
+    spectators_t &spect = mem.spectators;
+
+    if (spect.listener < 0) {
+        return;
+    }
+
+    render_events(mem);
+
+    if (poll(spect.fds.data(), spect.fds.size(), 0) > 0) {
+        for (size_t i = spect.fds.size() - 1; i > 0; i--) {
+            if (spect.fds[i].revents != 0 && !drain_spectator(spect, i)) {
+                remove_spectator(spect, i);
+            }
+        }
+
+        if (spect.fds[0].revents & POLLIN) {
+            accept_spectators(spect);
+        }
+    }
+
+    for (size_t i = spect.fds.size() - 1; i > 0; i--) {
+        if (!flush_spectator(spect, i)) {
+            remove_spectator(spect, i);
+        }
+    }
+}
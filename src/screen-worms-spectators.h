@@ -0,0 +1,18 @@
+#ifndef SK_SCREEN_WORMS_SPECTATORS_H
+#define SK_SCREEN_WORMS_SPECTATORS_H
+
+#include "screen-worms-server.h"
+
+enum constants_spectators {
+    SPECTATORS_BACKLOG = 64,
+    SPECTATOR_READ = 1024,
+};
+
+// Opens the listening socket for spectators if their port was given.
+void start_spectators(memory_server_t &mem);
+
+// Renders new events, takes new spectators and sends every one
+// the text it hasn't got yet, as much as its socket takes.
+void serve_spectators(memory_server_t &mem);
+
+#endif
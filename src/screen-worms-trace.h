@@ -0,0 +1,41 @@
+#ifndef SK_SCREEN_WORMS_TRACE_H
+#define SK_SCREEN_WORMS_TRACE_H
+
+#include <cstdint>
+
+// Trace of datagrams received by the server: header and then one record
+// per datagram, followed by its first min(len, TRACE_MAX_PAYLOAD) bytes.
+// Numbers are in host order, times in microseconds since the start of capture.
+enum constants_trace {
+    TRACE_MAGIC = 0x534b5754,
+    TRACE_VERSION = 1,
+    TRACE_MAX_PAYLOAD = 64,
+    TRACE_BUFFER = 1 << 20,
+    TRACE_FLUSH_SPAN = 1000000,
+};
+
+struct trace_header_t {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t start_time;
+} __attribute__((packed));
+
+struct trace_record_t {
+    uint64_t time;
+    uint8_t addr[16];
+    uint16_t port;
+    uint16_t len;
+} __attribute__((packed));
+
+// Datagrams received by a client are recorded whole: the same header with
+// DUMP_MAGIC and then every datagram after its record.
+enum constants_dump {
+    DUMP_MAGIC = 0x534b5744,
+};
+
+struct dump_record_t {
+    uint64_t time;
+    uint32_t len;
+} __attribute__((packed));
+
+#endif
@@ -0,0 +1,343 @@
+#include "screen-worms-uring.h"
+#include "screen-worms-latency.h"
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+static int io_uring_setup(unsigned entries, io_uring_params *params) {
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+static int io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+// Returns current time in microseconds.
+static uint64_t now_us() {
+    timeval tv {};
+    gettimeofday(&tv, nullptr);
+    return tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// Submits all prepared entries. If min_complete is positive waits
+// for that many completions.
+static void submit(uring_t &ring, unsigned min_complete) {
+    unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    int res = io_uring_enter(ring.fd, ring.to_submit, min_complete, flags);
+
+    if (res < 0 && errno != EINTR && errno != ETIME) {
+        cout<<"io_uring enter"<<endl;
+        exit(1);
+    }
+
+    if (res > 0) {
+        ring.to_submit -= res;
+    }
+}
+
+// Returns cleared submission entry. Submits prepared ones if the queue is full.
+static io_uring_sqe *get_sqe(uring_t &ring) {
+    unsigned head = __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *ring.sq_tail;
+
+    if (tail - head >= ring.sq_entries) {
+        submit(ring, 0);
+        head = __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+    }
+
+    unsigned index = tail & *ring.sq_mask;
+    io_uring_sqe *sqe = &ring.sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring.sq_array[index] = index;
+    __atomic_store_n(ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring.to_submit++;
+
+    return sqe;
+}
+
+// Gives receive buffer back to the kernel.
+static void recycle_buffer(uring_t &ring, uint16_t bid) {
+    uint16_t tail = *ring.bufs_tail;
+    io_uring_buf &buf = ring.bufs[tail & (URING_BUFFERS - 1)];
+
+    buf.addr = reinterpret_cast<uint64_t>(ring.buffers + bid * URING_BUFFER_SIZE);
+    buf.len = URING_BUFFER_SIZE;
+    buf.bid = bid;
+    __atomic_store_n(ring.bufs_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+// Posts multishot recvmsg on the socket.
+static void arm_receive(uring_t &ring) {
+    io_uring_sqe *sqe = get_sqe(ring);
+
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = ring.sock;
+    sqe->addr = reinterpret_cast<uint64_t>(&ring.recv_msg);
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->user_data = TAG_RECV;
+
+    ring.recv_armed = true;
+}
+
+// Moves received datagram from its buffer to the inbox.
+static void take_datagram(uring_t &ring, io_uring_cqe *cqe) {
+    uint16_t bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    uint8_t *buff = ring.buffers + bid * URING_BUFFER_SIZE;
+    auto *out = reinterpret_cast<io_uring_recvmsg_out*>(buff);
+    uint8_t *name = buff + sizeof(io_uring_recvmsg_out);
+    uint8_t *payload = name + ring.recv_msg.msg_namelen + ring.recv_msg.msg_controllen;
+    size_t payload_cap = URING_BUFFER_SIZE - (payload - buff);
+
+    if (ring.inbox_head == ring.inbox.size()) {
+        ring.inbox.clear();
+        ring.inbox_head = 0;
+    }
+
+    ring.inbox.emplace_back();
+    uring_datagram_t &datagram = ring.inbox.back();
+    memcpy(&datagram.addr, name, min<size_t>(out->namelen, sizeof(datagram.addr)));
+    datagram.len = out->payloadlen;
+
+    msghdr control {};
+    control.msg_control = name + ring.recv_msg.msg_namelen;
+    control.msg_controllen = out->controllen;
+    datagram.received = receive_timestamp(control);
+    memcpy(datagram.data, payload, min<size_t>(out->payloadlen, payload_cap));
+
+    recycle_buffer(ring, bid);
+}
+
+// Handles all entries from the completion queue.
+static void reap(uring_t &ring) {
+    unsigned head = *ring.cq_head;
+    unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; head++) {
+        io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+        uint64_t tag = cqe->user_data & TAG_MASK;
+
+        if (tag == TAG_RECV) {
+            if (cqe->res >= 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+                take_datagram(ring, cqe);
+            }
+
+            // Running out of buffers only ends the multishot receive.
+            if (cqe->res < 0 && cqe->res != -ENOBUFS) {
+                ring.broken = true;
+            }
+
+            if (!(cqe->flags & IORING_CQE_F_MORE)) {
+                ring.recv_armed = false;
+            }
+        }
+        else if (tag == TAG_SEND) {
+            ring.pending_sends--;
+
+            if (cqe->res < 0) {
+                ring.send_error = cqe->res;
+            }
+        }
+        else if (tag == TAG_TICK && (cqe->user_data >> TAG_BITS) == ring.armed_deadline) {
+            ring.armed_deadline = 0;
+        }
+    }
+
+    __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+
+    if (!ring.recv_armed && !ring.broken) {
+        arm_receive(ring);
+    }
+}
+
+void uring_close(uring_t &ring) {
+    if (ring.rings != nullptr) {
+        munmap(ring.rings, ring.rings_size);
+        ring.rings = nullptr;
+    }
+    if (ring.sqes != nullptr) {
+        munmap(ring.sqes, ring.sqes_size);
+        ring.sqes = nullptr;
+    }
+    if (ring.bufs != nullptr) {
+        munmap(ring.bufs, URING_BUFFERS * sizeof(io_uring_buf));
+        ring.bufs = nullptr;
+    }
+
+    delete[] ring.buffers;
+    ring.buffers = nullptr;
+
+    if (ring.fd >= 0) {
+        close(ring.fd);
+        ring.fd = -1;
+    }
+}
+
+// Undoes what uring_init has set up so far. Returns false for uring_init.
+static bool release(uring_t &ring) {
+    uring_close(ring);
+    return false;
+}
+
+bool uring_init(uring_t &ring, int sock) {
+    io_uring_params params {};
+    ring.sock = sock;
+    ring.fd = io_uring_setup(URING_ENTRIES, &params);
+
+    if (ring.fd < 0) {
+        return false;
+    }
+
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        return release(ring);
+    }
+
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    ring.rings_size = max(sq_size, cq_size);
+    ring.sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+
+    void *rings_map = mmap(nullptr, ring.rings_size, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+    void *sqes = mmap(nullptr, ring.sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+    ring.rings = rings_map == MAP_FAILED ? nullptr : rings_map;
+    ring.sqes = sqes == MAP_FAILED ? nullptr : static_cast<io_uring_sqe*>(sqes);
+
+    if (ring.rings == nullptr || ring.sqes == nullptr) {
+        return release(ring);
+    }
+
+    auto *rings = static_cast<uint8_t*>(rings_map);
+    ring.sq_head = reinterpret_cast<unsigned*>(rings + params.sq_off.head);
+    ring.sq_tail = reinterpret_cast<unsigned*>(rings + params.sq_off.tail);
+    ring.sq_mask = reinterpret_cast<unsigned*>(rings + params.sq_off.ring_mask);
+    ring.sq_array = reinterpret_cast<unsigned*>(rings + params.sq_off.array);
+    ring.sq_entries = params.sq_entries;
+
+    ring.cq_head = reinterpret_cast<unsigned*>(rings + params.cq_off.head);
+    ring.cq_tail = reinterpret_cast<unsigned*>(rings + params.cq_off.tail);
+    ring.cq_mask = reinterpret_cast<unsigned*>(rings + params.cq_off.ring_mask);
+    ring.cqes = reinterpret_cast<io_uring_cqe*>(rings + params.cq_off.cqes);
+
+    void *buf_ring = mmap(nullptr, URING_BUFFERS * sizeof(io_uring_buf), PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (buf_ring == MAP_FAILED) {
+        return release(ring);
+    }
+
+    ring.buffers = new uint8_t[URING_BUFFERS * URING_BUFFER_SIZE];
+    ring.bufs = static_cast<io_uring_buf*>(buf_ring);
+    ring.bufs_tail = &ring.bufs[0].resv;
+    io_uring_buf_reg reg {};
+    reg.ring_addr = reinterpret_cast<uint64_t>(buf_ring);
+    reg.ring_entries = URING_BUFFERS;
+    reg.bgid = URING_BUFFER_GROUP;
+
+    if (io_uring_register(ring.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        return release(ring);
+    }
+
+    for (uint16_t i = 0; i < URING_BUFFERS; i++) {
+        recycle_buffer(ring, i);
+    }
+
+    ring.recv_msg.msg_namelen = sizeof(sockaddr_in6);
+    // Room for receive timestamp, filled only if the socket has them on.
+    ring.recv_msg.msg_controllen = CMSG_SPACE(sizeof(timespec));
+    arm_receive(ring);
+    submit(ring, 0);
+
+    // Kernel without multishot recvmsg fails it already while submitting.
+    reap(ring);
+
+    if (ring.broken) {
+        return release(ring);
+    }
+
+    return true;
+}
+
+int uring_receive(uring_t &ring, void *buff, size_t len, sockaddr_in6 &addr, uint64_t &received) {
+    if (ring.inbox_head == ring.inbox.size()) {
+        reap(ring);
+    }
+
+    if (ring.inbox_head == ring.inbox.size()) {
+        return -1;
+    }
+
+    uring_datagram_t &datagram = ring.inbox[ring.inbox_head++];
+    memcpy(buff, datagram.data, min<size_t>(len, min<size_t>(datagram.len, URING_BUFFER_SIZE)));
+    addr = datagram.addr;
+    received = datagram.received;
+
+    return datagram.len;
+}
+
+int uring_send(uring_t &ring, mmsghdr *msgs, size_t cnt) {
+    int syscalls = 0;
+
+    for (size_t i = 0; i < cnt; i++) {
+        io_uring_sqe *sqe = get_sqe(ring);
+
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = ring.sock;
+        sqe->addr = reinterpret_cast<uint64_t>(&msgs[i].msg_hdr);
+        sqe->len = 1;
+        sqe->user_data = TAG_SEND;
+        ring.pending_sends++;
+    }
+
+    while (ring.pending_sends > 0) {
+        submit(ring, 1);
+        syscalls++;
+        reap(ring);
+    }
+
+    if (ring.send_error != 0) {
+        ring.send_error = 0;
+        return -1;
+    }
+
+    return syscalls;
+}
+
+void uring_wait(uring_t &ring, uint64_t deadline) {
+    if (ring.inbox_head != ring.inbox.size()) {
+        return;
+    }
+
+    if (deadline <= now_us()) {
+        if (ring.to_submit > 0) {
+            submit(ring, 0);
+        }
+
+        reap(ring);
+        return;
+    }
+
+    if (deadline != ring.armed_deadline) {
+        ring.tick.tv_sec = deadline / 1000000;
+        ring.tick.tv_nsec = deadline % 1000000 * 1000;
+        ring.armed_deadline = deadline;
+
+        io_uring_sqe *sqe = get_sqe(ring);
+        sqe->opcode = IORING_OP_TIMEOUT;
+        sqe->addr = reinterpret_cast<uint64_t>(&ring.tick);
+        sqe->len = 1;
+        sqe->timeout_flags = IORING_TIMEOUT_ABS | IORING_TIMEOUT_REALTIME;
+        sqe->user_data = (deadline << TAG_BITS) | TAG_TICK;
+    }
+
+    submit(ring, 1);
+    reap(ring);
+}
@@ -0,0 +1,103 @@
+#ifndef SK_SCREEN_WORMS_URING_H
+#define SK_SCREEN_WORMS_URING_H
+
+#include <bits/stdc++.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/io_uring.h>
+
+using namespace std;
+
+enum constants_uring {
+    URING_ENTRIES = 1024,
+    URING_BUFFERS = 1024,
+    URING_BUFFER_SIZE = 128,
+    URING_BUFFER_GROUP = 0,
+
+    // Low bits of user_data tell the kind of request, the rest may carry a value.
+    TAG_BITS = 2,
+    TAG_MASK = 3,
+    TAG_RECV = 1,
+    TAG_SEND,
+    TAG_TICK,
+};
+
+// Datagram taken from the completion queue, waiting to be read.
+struct uring_datagram_t {
+    sockaddr_in6 addr {};
+    uint32_t len = 0;
+    // Kernel's receive time (see screen-worms-latency.h), 0 if not known.
+    uint64_t received = 0;
+    uint8_t data[URING_BUFFER_SIZE] {};
+};
+
+// io_uring instance driven with raw system calls (liburing is not needed).
+// The socket has a multishot recvmsg posted all the time, which picks buffers
+// from a provided buffer ring, so receiving needs no system call per datagram.
+struct uring_t {
+    int fd = -1;
+    int sock = -1;
+
+    // Mappings of the rings, released by uring_close.
+    void *rings = nullptr;
+    size_t rings_size = 0;
+    size_t sqes_size = 0;
+
+    unsigned *sq_head = nullptr;
+    unsigned *sq_tail = nullptr;
+    unsigned *sq_mask = nullptr;
+    unsigned *sq_array = nullptr;
+    unsigned sq_entries = 0;
+    io_uring_sqe *sqes = nullptr;
+    unsigned to_submit = 0;
+
+    unsigned *cq_head = nullptr;
+    unsigned *cq_tail = nullptr;
+    unsigned *cq_mask = nullptr;
+    io_uring_cqe *cqes = nullptr;
+
+    // Provided buffer ring. Its tail overlays resv field of the first entry
+    // (io_uring_buf_ring can't be used, its bufs member is misplaced in C++).
+    io_uring_buf *bufs = nullptr;
+    uint16_t *bufs_tail = nullptr;
+    uint8_t *buffers = nullptr;
+    msghdr recv_msg {};
+    bool recv_armed = false;
+    // Set when the kernel failed the receive itself (not for lack of
+    // buffers), e.g. it doesn't know multishot recvmsg. Nothing more
+    // will be received through the ring then.
+    bool broken = false;
+
+    vector<uring_datagram_t> inbox;
+    size_t inbox_head = 0;
+
+    unsigned pending_sends = 0;
+    int send_error = 0;
+
+    __kernel_timespec tick {};
+    uint64_t armed_deadline = 0;
+};
+
+// Sets up the ring for given socket. Returns false if io_uring (or any
+// feature used) is not available, so the caller can fall back to sockets.
+bool uring_init(uring_t &ring, int sock);
+
+// Releases the ring, its mappings and buffers. The socket stays open.
+void uring_close(uring_t &ring);
+
+// Reads one received datagram without blocking. Works like recvfrom with
+// MSG_TRUNC: returns the real length of datagram or -1 if there is none
+// (for good if the ring is broken).
+// Kernel's receive time is given in received if the socket has timestamps on.
+int uring_receive(uring_t &ring, void *buff, size_t len, sockaddr_in6 &addr, uint64_t &received);
+
+// Sends all messages and waits for their completion. Returns amount of
+// system calls made or -1 if any of the sends failed.
+int uring_send(uring_t &ring, mmsghdr *msgs, size_t cnt);
+
+// Waits until a datagram arrives or the deadline (in microseconds
+// of CLOCK_REALTIME) passes. The deadline is a timeout request in the ring.
+void uring_wait(uring_t &ring, uint64_t deadline);
+
+#endif